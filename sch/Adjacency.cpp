@@ -0,0 +1,106 @@
+#include "Adjacency.h"
+#include "Subckt.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace sch {
+
+Adjacency::Adjacency() {
+	nets = 0;
+	offset.push_back(0);
+}
+
+Adjacency::Adjacency(const Subckt &ckt) {
+	nets = (int)ckt.nets.size();
+
+	int count = 0;
+	for (auto n = ckt.nets.begin(); n != ckt.nets.end(); n++) {
+		for (int type = 0; type < 2; type++) {
+			count += (int)(n->gateOf[type].size() + n->sourceOf[type].size() + n->drainOf[type].size());
+		}
+	}
+
+	offset.reserve(nets*6+1);
+	devs.reserve(count);
+	offset.push_back(0);
+	for (auto n = ckt.nets.begin(); n != ckt.nets.end(); n++) {
+		for (int role = 0; role < 3; role++) {
+			for (int type = 0; type < 2; type++) {
+				const vector<int> &terms = (role == GATE ? n->gateOf[type] : (role == SOURCE ? n->sourceOf[type] : n->drainOf[type]));
+				devs.insert(devs.end(), terms.begin(), terms.end());
+				offset.push_back((int)devs.size());
+			}
+		}
+	}
+
+	gate.reserve(ckt.mos.size());
+	source.reserve(ckt.mos.size());
+	drain.reserve(ckt.mos.size());
+	for (auto d = ckt.mos.begin(); d != ckt.mos.end(); d++) {
+		gate.push_back(d->gate);
+		source.push_back(d->source);
+		drain.push_back(d->drain);
+	}
+
+	netColor.reserve(nets);
+	for (auto n = ckt.nets.begin(); n != ckt.nets.end(); n++) {
+		netColor.push_back(n->isIO ? 1 : 0);
+	}
+}
+
+Adjacency::~Adjacency() {
+}
+
+int Adjacency::color(int net) const {
+	return netColor[net];
+}
+
+int Adjacency::colors() const {
+	return 12;
+}
+
+// See Subckt::comparePartitions()
+int Adjacency::comparePartitions(const Partition &pi0, const Partition &pi1) const {
+	vector<pair<int, int> > g0, g1;
+	for (int i = 0; i < nets; i++) {
+		int n0 = pi0.lab[i];
+		int n1 = pi1.lab[i];
+
+		for (int type = 0; type < 2; type++) {
+			g0.clear();
+			for (auto j = begin(n0, SOURCE, type); j != end(n0, SOURCE, type); j++) {
+				g0.push_back(pair<int, int>(pi0.pos[drain[*j]], pi0.pos[gate[*j]]));
+			}
+			sort(g0.begin(), g0.end());
+			g1.clear();
+			for (auto j = begin(n1, SOURCE, type); j != end(n1, SOURCE, type); j++) {
+				g1.push_back(pair<int, int>(pi1.pos[drain[*j]], pi1.pos[gate[*j]]));
+			}
+			sort(g1.begin(), g1.end());
+
+			int m = (int)min(g0.size(), g1.size());
+			for (int j = 0; j < m; j++) {
+				if (g0[j] < g1[j]) {
+					return -1;
+				} else if (g1[j] < g0[j]) {
+					return 1;
+				}
+			}
+
+			if (m < (int)g0.size()) {
+				return -1;
+			} else if (m < (int)g1.size()) {
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+int Adjacency::verts() const {
+	return nets;
+}
+
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <vector>
+#include <array>
+
+#include "Isomorph.h"
+
+using namespace std;
+
+namespace sch {
+
+struct Subckt;
+
+// This is a frozen, read-only view of the connectivity of a Subckt stored in
+// compressed sparse row (CSR) form. Every Net in a Subckt keeps six separately
+// allocated vectors of devices, which is convenient while the netlist is being
+// built, but scatters the graph across the heap. This packs all of the
+// terminals into one contiguous array indexed by net, role, and transistor
+// type so that the read-heavy graph algorithms (canonicalization in
+// particular) walk memory linearly.
+//
+// The view is not updated when the Subckt changes. Build a new one after
+// modifying the netlist.
+struct Adjacency {
+	Adjacency();
+	Adjacency(const Subckt &ckt);
+	~Adjacency();
+
+	// The role that a net plays on a transistor terminal
+	enum {
+		GATE = 0,
+		SOURCE = 1,
+		DRAIN = 2
+	};
+
+	int nets;
+
+	// The devices on which net n plays role r as a transistor of type t are
+	// devs[offset[slot(n, r, t)]] through devs[offset[slot(n, r, t)+1]-1]
+	vector<int> offset;
+	vector<int> devs;
+
+	// Terminals of each device, index into nets
+	vector<int> gate;
+	vector<int> source;
+	vector<int> drain;
+
+	// The color of each net, see color(). Ports are 1 and internal nets are
+	// 0, but a caller may split the ports further before canonicalizing.
+	vector<int> netColor;
+
+	static int slot(int net, int role, int type) {
+		return (net*3 + role)*2 + type;
+	}
+
+	const int *begin(int net, int role, int type) const {
+		return devs.data() + offset[slot(net, role, type)];
+	}
+
+	const int *end(int net, int role, int type) const {
+		return devs.data() + offset[slot(net, role, type)+1];
+	}
+
+	int size(int net, int role, int type) const {
+		return offset[slot(net, role, type)+1] - offset[slot(net, role, type)];
+	}
+
+	// Implements the Graph concept used by canonicalLabels(). These give the
+	// same results as the implementations on Subckt.
+	int color(int net) const;
+	int colors() const;
+	int comparePartitions(const Partition &pi0, const Partition &pi1) const;
+	int verts() const;
+
+	// See Subckt::adjacent()
+	template <typename Visit>
+	void adjacent(int net, int c, Visit visit) const {
+		static const int from[6] = {SOURCE, DRAIN, GATE, GATE, SOURCE, DRAIN};
+		int type = c/6;
+		int role = c%6;
+		const vector<int> &to = (role == 1 or role == 2) ? source : (role == 0 or role == 3 ? drain : gate);
+		for (auto i = begin(net, from[role], type); i != end(net, from[role], type); i++) {
+			visit(to[*i]);
+		}
+	}
+};
+
+}
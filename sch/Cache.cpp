@@ -0,0 +1,439 @@
+#include "Cache.h"
+#include "Draw.h"
+#include "Netlist.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <filesystem>
+#include <random>
+#include <map>
+#include <tuple>
+
+using namespace std;
+
+namespace sch {
+
+// Bump this whenever the file format, the placer, the router, or the drawing
+// engine changes in a way that invalidates previously cached cells.
+static const int CACHE_VERSION = 5;
+
+static bool readInt(FILE *fptr, int &value) {
+	return fscanf(fptr, "%d", &value) == 1;
+}
+
+static bool readSize(FILE *fptr, size_t &value) {
+	unsigned long long v = 0;
+	if (fscanf(fptr, "%llu", &v) != 1) {
+		return false;
+	}
+	value = (size_t)v;
+	return true;
+}
+
+static bool readDouble(FILE *fptr, double &value) {
+	return fscanf(fptr, "%lf", &value) == 1;
+}
+
+// Strings are written with a leading '=' so that empty names survive the
+// round trip.
+static bool readString(FILE *fptr, string &value) {
+	char buf[1024];
+	if (fscanf(fptr, "%1023s", buf) != 1 or buf[0] != '=') {
+		return false;
+	}
+	value = string(buf+1);
+	return true;
+}
+
+static bool readKeyword(FILE *fptr, const char *keyword) {
+	char buf[64];
+	return fscanf(fptr, "%63s", buf) == 1 and string(buf) == keyword;
+}
+
+static bool readVec(FILE *fptr, vec2i &value) {
+	return readInt(fptr, value[0]) and readInt(fptr, value[1]);
+}
+
+static bool isPinLayer(const Tech &tech, int draw) {
+	for (int i = 0; i < (int)tech.wires.size(); i++) {
+		if (tech.wires[i].pin >= 0 and tech.wires[i].pin == draw) {
+			return true;
+		}
+	}
+	for (int i = 0; i < (int)tech.subst.size(); i++) {
+		if (tech.subst[i].pin >= 0 and tech.subst[i].pin == draw) {
+			return true;
+		}
+	}
+	return false;
+}
+
+CellCache::CellCache() {
+}
+
+CellCache::CellCache(string dir) {
+	this->dir = dir;
+}
+
+CellCache::~CellCache() {
+}
+
+string CellCache::path(const Subckt &ckt) const {
+	return (filesystem::path(dir) / ("cell_" + idToString(ckt.id) + ".cell")).string();
+}
+
+bool CellCache::load(Layout &dst, Subckt &ckt, int *status, array<vector<Device>, 2> *stack) const {
+	if (dir.empty() or ckt.id == (size_t)-1) {
+		return false;
+	}
+
+	FILE *fptr = fopen(path(ckt).c_str(), "r");
+	if (fptr == nullptr) {
+		return false;
+	}
+
+	// Parse the cached subckt
+	Subckt cached(true);
+	int version = -1;
+	int count = 0;
+	bool success = readKeyword(fptr, "cell")
+		and readInt(fptr, version) and version == CACHE_VERSION
+		and readSize(fptr, cached.id) and cached.id == ckt.id
+		and readKeyword(fptr, "nets") and readInt(fptr, count);
+	for (int i = 0; success and i < count; i++) {
+		string name;
+		int isIO = 0, remoteIO = 0;
+		success = readString(fptr, name) and readInt(fptr, isIO) and readInt(fptr, remoteIO);
+		int net = cached.pushNet(name, isIO);
+		cached.nets[net].remoteIO = remoteIO;
+	}
+
+	success = success and readKeyword(fptr, "ports") and readInt(fptr, count);
+	cached.ports.assign(max(count, 0), -1);
+	for (int i = 0; success and i < count; i++) {
+		success = readInt(fptr, cached.ports[i]);
+	}
+
+	success = success and readKeyword(fptr, "mos") and readInt(fptr, count);
+	for (int i = 0; success and i < count; i++) {
+		Mos m;
+		int params = 0;
+		success = readInt(fptr, m.model) and readInt(fptr, m.type)
+			and readInt(fptr, m.drain) and readInt(fptr, m.gate)
+			and readInt(fptr, m.source) and readInt(fptr, m.base)
+			and readVec(fptr, m.size) and readVec(fptr, m.area) and readVec(fptr, m.perim)
+			and readInt(fptr, params);
+		for (int j = 0; success and j < params; j++) {
+			string name;
+			int values = 0;
+			success = readString(fptr, name) and readInt(fptr, values);
+			vector<double> &param = m.params[name];
+			param.resize(max(values, 0));
+			for (int k = 0; success and k < values; k++) {
+				success = readDouble(fptr, param[k]);
+			}
+		}
+
+		int n = (int)cached.nets.size();
+		success = success and m.drain >= 0 and m.drain < n and m.gate >= 0 and m.gate < n
+			and m.source >= 0 and m.source < n and m.base < n;
+		if (success) {
+			int idx = cached.pushMos(m.model, m.type, m.drain, m.gate, m.source, m.base);
+			cached.mos[idx].size = m.size;
+			cached.mos[idx].area = m.area;
+			cached.mos[idx].perim = m.perim;
+			cached.mos[idx].params = m.params;
+		}
+	}
+
+	// Make sure this is actually the same cell and not a hash collision
+	success = success and cached.nets.size() == ckt.nets.size()
+		and cached.mos.size() == ckt.mos.size()
+		and cached.ports == ckt.ports
+		and cached.compare(ckt) == 0;
+
+	// The device order isn't canonical, so we need to match up the cached
+	// devices with the devices in ckt.
+	vector<int> devices(cached.mos.size(), -1);
+	if (success) {
+		map<tuple<int, int, int, int, int, int>, vector<int> > available;
+		for (int i = (int)ckt.mos.size()-1; i >= 0; i--) {
+			const Mos &m = ckt.mos[i];
+			available[make_tuple(m.type, m.model, m.drain, m.gate, m.source, m.base)].push_back(i);
+		}
+
+		for (int i = 0; success and i < (int)cached.mos.size(); i++) {
+			const Mos &m = cached.mos[i];
+			auto pos = available.find(make_tuple(m.type, m.model, m.drain, m.gate, m.source, m.base));
+			success = false;
+			if (pos != available.end()) {
+				for (int j = (int)pos->second.size()-1; j >= 0 and not success; j--) {
+					if (ckt.mos[pos->second[j]] == m) {
+						devices[i] = pos->second[j];
+						pos->second.erase(pos->second.begin()+j);
+						success = true;
+					}
+				}
+			}
+		}
+	}
+
+	// Parse the placement
+	array<vector<Device>, 2> place;
+	for (int type = 0; success and type < 2; type++) {
+		success = readKeyword(fptr, "stack") and readInt(fptr, count);
+		for (int i = 0; success and i < count; i++) {
+			int device = -1, flip = 0;
+			success = readInt(fptr, device) and readInt(fptr, flip) and device < (int)devices.size();
+			if (success) {
+				place[type].push_back(Device{device >= 0 ? devices[device] : -1, flip != 0});
+			}
+		}
+	}
+
+	int result = 0;
+	success = success and readKeyword(fptr, "status") and readInt(fptr, result);
+
+	// Parse the layout
+	Rect box;
+	success = success and readKeyword(fptr, "layout")
+		and readVec(fptr, box.ll) and readVec(fptr, box.ur)
+		and readInt(fptr, count);
+	vector<pair<int, vector<Rect> > > layers(max(count, 0));
+	for (int i = 0; success and i < count; i++) {
+		int rects = 0;
+		success = readInt(fptr, layers[i].first) and readInt(fptr, rects);
+		layers[i].second.resize(max(rects, 0));
+		for (int j = 0; success and j < rects; j++) {
+			Rect &r = layers[i].second[j];
+			success = readInt(fptr, r.net) and readVec(fptr, r.ll) and readVec(fptr, r.ur);
+		}
+	}
+	fclose(fptr);
+
+	if (not success) {
+		return false;
+	}
+
+	for (int i = 0; i < (int)cached.mos.size(); i++) {
+		ckt.mos[devices[i]].area = cached.mos[i].area;
+		ckt.mos[devices[i]].perim = cached.mos[i].perim;
+	}
+
+	drawNets(dst, ckt);
+	dst.box.bound(box.ll, box.ur);
+	for (auto layer = layers.begin(); layer != layers.end(); layer++) {
+		auto dstLayer = dst.at(layer->first);
+		for (auto r = layer->second.begin(); r != layer->second.end(); r++) {
+			dstLayer->push(*r);
+		}
+	}
+	drawPorts(dst, ckt);
+
+	if (status != nullptr) {
+		*status = result;
+	}
+	if (stack != nullptr) {
+		*stack = place;
+	}
+	return true;
+}
+
+bool CellCache::save(const Layout &src, const Subckt &ckt, const Placement &pl, int status) const {
+	if (dir.empty() or ckt.id == (size_t)-1) {
+		return false;
+	}
+
+	error_code ec;
+	filesystem::create_directories(dir, ec);
+
+	// Write to a temporary file first so that another run reading the cache
+	// never sees a partially written entry.
+	string dst = path(ckt);
+	string tmp = dst + "." + to_string(std::random_device{}()) + ".tmp";
+	FILE *fptr = fopen(tmp.c_str(), "w");
+	if (fptr == nullptr) {
+		return false;
+	}
+
+	fprintf(fptr, "cell %d %llu\n", CACHE_VERSION, (unsigned long long)ckt.id);
+
+	fprintf(fptr, "nets %d\n", (int)ckt.nets.size());
+	for (auto n = ckt.nets.begin(); n != ckt.nets.end(); n++) {
+		fprintf(fptr, "=%s %d %d\n", n->name.c_str(), (int)n->isIO, (int)n->remoteIO);
+	}
+
+	fprintf(fptr, "ports %d", (int)ckt.ports.size());
+	for (auto p = ckt.ports.begin(); p != ckt.ports.end(); p++) {
+		fprintf(fptr, " %d", *p);
+	}
+	fprintf(fptr, "\n");
+
+	fprintf(fptr, "mos %d\n", (int)ckt.mos.size());
+	for (auto m = ckt.mos.begin(); m != ckt.mos.end(); m++) {
+		fprintf(fptr, "%d %d %d %d %d %d %d %d %d %d %d %d %d", m->model, m->type, m->drain, m->gate, m->source, m->base, m->size[0], m->size[1], m->area[0], m->area[1], m->perim[0], m->perim[1], (int)m->params.size());
+		for (auto p = m->params.begin(); p != m->params.end(); p++) {
+			fprintf(fptr, " =%s %d", p->first.c_str(), (int)p->second.size());
+			for (auto v = p->second.begin(); v != p->second.end(); v++) {
+				fprintf(fptr, " %.17g", *v);
+			}
+		}
+		fprintf(fptr, "\n");
+	}
+
+	for (int type = 0; type < 2; type++) {
+		fprintf(fptr, "stack %d", (int)pl.stack[type].size());
+		for (auto d = pl.stack[type].begin(); d != pl.stack[type].end(); d++) {
+			fprintf(fptr, " %d %d", d->device, (int)d->flip);
+		}
+		fprintf(fptr, "\n");
+	}
+
+	fprintf(fptr, "status %d\n", status);
+
+	// Port labels and pins are regenerated by drawPorts() when the entry is
+	// loaded.
+	int count = 0;
+	for (auto layer = src.layers.begin(); layer != src.layers.end(); layer++) {
+		count += not isPinLayer(*src.tech, layer->draw);
+	}
+	fprintf(fptr, "layout %d %d %d %d %d\n", src.box.ll[0], src.box.ll[1], src.box.ur[0], src.box.ur[1], count);
+	for (auto layer = src.layers.begin(); layer != src.layers.end(); layer++) {
+		if (isPinLayer(*src.tech, layer->draw)) {
+			continue;
+		}
+
+		fprintf(fptr, "%d %d\n", layer->draw, (int)layer->geo.size());
+		for (auto r = layer->geo.begin(); r != layer->geo.end(); r++) {
+			fprintf(fptr, "%d %d %d %d %d\n", r->net, r->ll[0], r->ll[1], r->ur[0], r->ur[1]);
+		}
+	}
+
+	bool success = not ferror(fptr);
+	success = (fclose(fptr) == 0) and success;
+	if (success) {
+		filesystem::rename(tmp, dst, ec);
+		success = not ec;
+	}
+	if (not success) {
+		filesystem::remove(tmp, ec);
+	}
+	return success;
+}
+
+SpacingCache::SpacingCache(const Tech &tech) {
+	this->tech = &tech;
+	capacity = 64 << 20;
+}
+
+SpacingCache::~SpacingCache() {
+}
+
+bool SpacingCache::Key::operator==(const Key &k) const {
+	return hash == k.hash and offset == k.offset and axis == k.axis
+		and shift == k.shift and substrateMode == k.substrateMode
+		and routingMode == k.routingMode and mergeNet == k.mergeNet
+		and rects == k.rects;
+}
+
+size_t SpacingCache::KeyHash::operator()(const Key &k) const {
+	return (size_t)(k.hash[0] ^ (k.hash[1] >> 1));
+}
+
+// Both halves of the fingerprint see every value, but they mix it
+// differently so that a collision in one is unlikely to be a collision in
+// the other.
+static void writeKey(array<uint64_t, 2> &hash, int value) {
+	uint64_t v = (uint64_t)(uint32_t)value;
+	hash[0] = (hash[0] ^ v) * 0x100000001b3ull;
+	hash[1] ^= v * 0x9e3779b97f4a7c15ull;
+	hash[1] = ((hash[1] << 31) | (hash[1] >> 33)) * 0xbf58476d1ce4e5b9ull;
+}
+
+// Nets are numbered by their first appearance in nets. There are only ever a
+// handful of them, so a linear search is fine.
+static int writeKey(array<uint64_t, 2> &hash, const Layout &layout, vector<int> &nets) {
+	int rects = 0;
+	writeKey(hash, (int)layout.layers.size());
+	for (auto layer = layout.layers.begin(); layer != layout.layers.end(); layer++) {
+		writeKey(hash, layer->draw);
+		writeKey(hash, (int)layer->geo.size());
+		rects += (int)layer->geo.size();
+		for (auto r = layer->geo.begin(); r != layer->geo.end(); r++) {
+			int net = -1;
+			if (r->net >= 0) {
+				net = (int)(find(nets.begin(), nets.end(), r->net) - nets.begin());
+				if (net == (int)nets.size()) {
+					nets.push_back(r->net);
+				}
+			}
+			writeKey(hash, r->ll[0]);
+			writeKey(hash, r->ll[1]);
+			writeKey(hash, r->ur[0]);
+			writeKey(hash, r->ur[1]);
+			writeKey(hash, net);
+		}
+	}
+	return rects;
+}
+
+bool SpacingCache::minOffset(int *offset, int axis, const Layout &l0, int l0Shift, const Layout &l1, int l1Shift, int substrateMode, int routingMode, bool mergeNet) {
+	Key key;
+	key.hash[0] = 0xcbf29ce484222325ull;
+	key.hash[1] = 0x84222325cbf29ce4ull;
+	key.offset = *offset;
+	key.axis = axis;
+	key.shift = l1Shift - l0Shift;
+	key.substrateMode = substrateMode;
+	key.routingMode = routingMode;
+	key.mergeNet = (int)mergeNet;
+	vector<int> nets;
+	key.rects = writeKey(key.hash, l0, nets);
+	writeKey(key.hash, -1);
+	key.rects += writeKey(key.hash, l1, nets);
+
+	// An entry costs about this much in an unordered_map, counting the node,
+	// its next pointer, and its bucket.
+	static const size_t entrySize = sizeof(Table::value_type) + 3*sizeof(void*);
+	size_t limit = max((size_t)1, capacity/2/entrySize);
+
+	{
+		lock_guard<mutex> guard(lock);
+		auto pos = entries.find(key);
+		if (pos != entries.end()) {
+			*offset = pos->second.second;
+			return pos->second.first;
+		}
+
+		pos = older.find(key);
+		if (pos != older.end()) {
+			pair<bool, int> result = pos->second;
+			older.erase(pos);
+			if (entries.size() >= limit) {
+				older.swap(entries);
+				entries.clear();
+			}
+			entries.insert(Table::value_type(key, result));
+			*offset = result.second;
+			return result.first;
+		}
+	}
+
+	bool found = phy::minOffset(offset, axis, l0, l0Shift, l1, l1Shift, substrateMode, routingMode, mergeNet);
+
+	lock_guard<mutex> guard(lock);
+	if (entries.size() >= limit) {
+		older.swap(entries);
+		entries.clear();
+	}
+	entries.insert(Table::value_type(key, pair<bool, int>(found, *offset)));
+	return found;
+}
+
+void SpacingCache::clear() {
+	lock_guard<mutex> guard(lock);
+	entries.clear();
+	older.clear();
+}
+
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <phy/Layout.h>
+
+#include "Subckt.h"
+#include "Placer.h"
+
+#include <string>
+#include <array>
+#include <vector>
+#include <mutex>
+#include <cstdint>
+#include <unordered_map>
+
+using namespace std;
+
+namespace sch {
+
+// This is a persistent, content addressed cache of finished cells. Each
+// entry is keyed by the canonical hash computed in Subckt::canonicalize() and
+// stores the canonical subckt, the chosen placement, the result of the router,
+// and the drawn layout. This allows routeCell() to skip placement and routing
+// for any cell that was already finished in a previous run.
+//
+// The key doesn't include the technology, so use a separate cache directory
+// for each technology.
+struct CellCache {
+	CellCache();
+	CellCache(string dir);
+	~CellCache();
+
+	string dir;
+
+	string path(const Subckt &ckt) const;
+
+	// Load the cached layout for ckt into dst. ckt must already be
+	// canonicalized. The cached transistor area and perimeter annotations are
+	// copied into ckt.mos. If stack is not null, it is filled with the cached
+	// placement using indices into ckt.mos. Returns false if there is no entry
+	// for this cell.
+	bool load(Layout &dst, Subckt &ckt, int *status=nullptr, array<vector<Device>, 2> *stack=nullptr) const;
+
+	// Store a finished cell. Returns false if the entry could not be written.
+	bool save(const Layout &src, const Subckt &ckt, const Placement &pl, int status) const;
+};
+
+// This memoizes phy::minOffset(). The router asks for the spacing between the
+// same pin and via layouts over and over, both from one iteration of
+// Router::solve() to the next and from one cell to the next. Each entry is
+// keyed by the geometry of both layouts relative to their origins, with the
+// nets renumbered in order of appearance so that only which rectangles
+// share a net matters, along with the arguments to minOffset(). Since the
+// answer doesn't change when both layouts are shifted together, only the
+// difference between the two shifts is part of the key.
+//
+// The geometry is reduced to a 128 bit fingerprint, and the arguments and
+// the number of rectangles are stored as is and checked on every hit. Each
+// cache belongs to the technology that it was constructed with, which must
+// outlive it, so the technology isn't part of the key.
+//
+// This is safe to share between threads.
+struct SpacingCache {
+	SpacingCache(const Tech &tech);
+	~SpacingCache();
+
+	struct Key {
+		array<uint64_t, 2> hash;
+		int offset;
+		int axis;
+		int shift;
+		int substrateMode;
+		int routingMode;
+		int mergeNet;
+		int rects;
+
+		bool operator==(const Key &k) const;
+	};
+
+	struct KeyHash {
+		size_t operator()(const Key &k) const;
+	};
+
+	typedef unordered_map<Key, pair<bool, int>, KeyHash> Table;
+
+	const Tech *tech;
+
+	// The approximate number of bytes the cache may use. Entries are kept in
+	// two generations that each get half of this. Once the newer one is full,
+	// the older one is dropped and the newer one takes its place, so the
+	// entries that are still in use survive.
+	size_t capacity;
+
+	mutex lock;
+	Table entries;
+	Table older;
+
+	// Same arguments and results as phy::minOffset(). The layouts must be
+	// drawn in this cache's technology.
+	bool minOffset(int *offset, int axis, const Layout &l0, int l0Shift, const Layout &l1, int l1Shift, int substrateMode=Layout::DEFAULT, int routingMode=Layout::DEFAULT, bool mergeNet=true);
+	void clear();
+};
+
+}
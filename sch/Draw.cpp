@@ -395,17 +395,21 @@ void drawStack(Layout &dst, const Subckt &ckt, const Stack &stack) {
 	}
 }
 
-void drawCell(Layout &dst, const Router &rt) {
-	vec2i dir(1,-1);
-	dst.name = rt.ckt->name;
-
-	dst.nets.reserve(rt.ckt->nets.size());
-	for (int i = 0; i < (int)rt.ckt->nets.size(); i++) {
-		dst.nets.push_back(rt.ckt->nets[i].name);
-		dst.nets.back().isInput = rt.ckt->nets[i].remoteIO and rt.ckt->nets[i].isInput();
-		dst.nets.back().isOutput = rt.ckt->nets[i].remoteIO and rt.ckt->nets[i].isOutput();
+void drawNets(Layout &dst, const Subckt &ckt) {
+	dst.name = ckt.name;
+
+	dst.nets.reserve(ckt.nets.size());
+	for (int i = 0; i < (int)ckt.nets.size(); i++) {
+		dst.nets.push_back(ckt.nets[i].name);
+		dst.nets.back().isInput = ckt.nets[i].remoteIO and ckt.nets[i].isInput();
+		dst.nets.back().isOutput = ckt.nets[i].remoteIO and ckt.nets[i].isOutput();
 		// TODO(edward.bingham) information about power and ground
 	}
+}
+
+void drawCell(Layout &dst, const Router &rt) {
+	vec2i dir(1,-1);
+	drawNets(dst, *rt.ckt);
 
 	for (auto i = rt.routes.begin(); i != rt.routes.end(); i++) {
 		//if ((int)i->pins.size() > 1) {
@@ -496,18 +500,22 @@ void drawCell(Layout &dst, const Router &rt) {
 	plab = dst.tech->findPaint("pwell.label");
 	nwell = dst.tech->findPaint("nwell.drawing");*/	
 
+	drawPorts(dst, *rt.ckt);
+}
+
+void drawPorts(Layout &dst, const Subckt &ckt) {
 	// Find best place to put the pin for the ports
 	vector<bool> nets;
-	nets.resize(rt.ckt->nets.size(), false);
+	nets.resize(ckt.nets.size(), false);
 	for (int i = (int)dst.tech->wires.size()-1; i >= 0; i--) {
 		auto layer = dst.find(dst.tech->wires[i].draw);
 		if (layer != dst.layers.end()) {
 			for (int j = (int)layer->geo.size()-1; j >= 0; j--) {
 				auto r = layer->geo.begin()+j;
-				for (int k = 0; k < (int)rt.ckt->nets.size(); k++) {
+				for (int k = 0; k < (int)ckt.nets.size(); k++) {
 					if (not nets[k] and r->net == k) {
-						dst.label(dst.tech->wires[i].label, Label(k, r->center(), rt.ckt->nets[k].name));
-						if (find(rt.ckt->ports.begin(), rt.ckt->ports.end(), k) != rt.ckt->ports.end()) {
+						dst.label(dst.tech->wires[i].label, Label(k, r->center(), ckt.nets[k].name));
+						if (find(ckt.ports.begin(), ckt.ports.end(), k) != ckt.ports.end()) {
 							dst.push(dst.tech->wires[i].pin, *r);
 						}
 						nets[k] = true;
@@ -522,10 +530,10 @@ void drawCell(Layout &dst, const Router &rt) {
 		if (layer != dst.layers.end()) {
 			for (int j = (int)layer->geo.size()-1; j >= 0; j--) {
 				auto r = layer->geo.begin()+j;
-				for (int k = 0; k < (int)rt.ckt->nets.size(); k++) {
+				for (int k = 0; k < (int)ckt.nets.size(); k++) {
 					if (not nets[k] and r->net == k) {
-						dst.label(dst.tech->subst[i].label, Label(k, r->center(), rt.ckt->nets[k].name));
-						if (find(rt.ckt->ports.begin(), rt.ckt->ports.end(), k) != rt.ckt->ports.end()) {
+						dst.label(dst.tech->subst[i].label, Label(k, r->center(), ckt.nets[k].name));
+						if (find(ckt.ports.begin(), ckt.ports.end(), k) != ckt.ports.end()) {
 							dst.push(dst.tech->subst[i].pin, *r);
 						}
 						nets[k] = true;
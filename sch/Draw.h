@@ -19,7 +19,9 @@ void drawViaStack(Layout &dst, int net, int base, int downLevel, int upLevel, ve
 void drawWire(Layout &dst, const Router &rt, const Wire &wire, vec2i pos=vec2i(0,0), vec2i dir=vec2i(1,1));
 void drawPin(Layout &dst, const Subckt &ckt, const Stack &stack, int pinID, vec2i pos=vec2i(0,0), vec2i dir=vec2i(1,1));
 void drawStack(Layout &dst, const Subckt &ckt, const Stack &stack);
+void drawNets(Layout &dst, const Subckt &ckt);
 void drawCell(Layout &dst, const Router &rt);
+void drawPorts(Layout &dst, const Subckt &ckt);
 void drawLayout(Layout &dst, const Layout &src, vec2i pos=vec2i(0,0), vec2i dir=vec2i(1,1));
 
 }
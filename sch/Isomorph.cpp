@@ -9,42 +9,41 @@ using namespace std;
 
 namespace sch {
 
-Partition Partition::unit(int size) {
-	Partition result;
-	result.cells.push_back(vector<int>());
-	result.cells.back().reserve(size);
-	for (int i = 0; i < size; i++) {
-		result.cells.back().push_back(i);
-	}
-	return result;
+Partition::Partition() {
+	cells = 0;
 }
 
-Partition Partition::discrete(int size) {
-	Partition result;
-	result.cells.reserve(size);
+Partition::Partition(int size) {
+	lab.reserve(size);
+	pos.reserve(size);
 	for (int i = 0; i < size; i++) {
-		result.cells.push_back(vector<int>(1, i));
+		lab.push_back(i);
+		pos.push_back(i);
 	}
-	return result;
+	start.resize(size, 0);
+	length.resize(size, 0);
+	if (size > 0) {
+		length[0] = size;
+	}
+	cells = (size > 0 ? 1 : 0);
+
+	count.resize(size, 0);
+	queued.resize(size, 0);
+}
+
+Partition::~Partition() {
 }
 
 int Partition::cellOf(int v) const {
-	for (int i = 0; i < (int)cells.size(); i++) {
-		for (int j = 0; j < (int)cells[i].size(); j++) {
-			if (cells[i][j] == v) {
-				return i;
-			}
-		}
-	}
-	return -1;
+	return start[pos[v]];
 }
 
 int Partition::next() const {
 	int curr = -1;
-	for (int i = 0; i < (int)cells.size(); i++) {
-		if (cells[i].size() == 2) {
+	for (int i = 0; i < (int)lab.size(); i += length[i]) {
+		if (length[i] == 2) {
 			return i;
-		} else if (cells[i].size() > 2 and (curr < 0 or cells[i].size() < cells[curr].size())) {
+		} else if (length[i] > 2 and (curr < 0 or length[i] < length[curr])) {
 			curr = i;
 		}
 	}
@@ -52,58 +51,215 @@ int Partition::next() const {
 }
 
 bool Partition::isDiscrete(int ci) const {
-	return cells[ci].size() == 1;
+	return length[ci] == 1;
 }
 
 bool Partition::isDiscrete() const {
-	for (auto p = cells.begin(); p != cells.end(); p++) {
-		if (p->size() != 1) {
-			return false;
+	return cells == (int)lab.size();
+}
+
+// Split v off into a cell of its own at the front of its current cell.
+// Returns the start position of the new cell.
+int Partition::individualize(int v) {
+	int s = start[pos[v]];
+	int len = length[s];
+	if (len == 1) {
+		return s;
+	}
+
+	int u = lab[s];
+	lab[pos[v]] = u;
+	pos[u] = pos[v];
+	lab[s] = v;
+	pos[v] = s;
+
+	length[s] = 1;
+	length[s+1] = len-1;
+	for (int i = s+1; i < s+len; i++) {
+		start[i] = s+1;
+	}
+	cells++;
+	trail.push_back(s+1);
+	return s;
+}
+
+// Merge cells back together in the reverse order that they were split until
+// the trail is mark entries long. Cells are never reordered, only split, so
+// every cell on the trail is merged back into the cell just before it. This
+// leaves the vertices of each cell in a different order than before, but the
+// cells themselves are the same.
+void Partition::undo(int mark) {
+	while ((int)trail.size() > mark) {
+		int b = trail.back();
+		trail.pop_back();
+
+		int s = start[b-1];
+		for (int i = b; i < b+length[b]; i++) {
+			start[i] = s;
 		}
+		length[s] += length[b];
+		cells--;
 	}
-	return true;
 }
 
-Partition Partition::pop(int ci, int vi) {
-	cells.push_back(vector<int>(1, cells[ci][vi]));
-	cells[ci].erase(cells[ci].begin()+vi);
-	Partition result;
-	result.cells.push_back(cells.back());
-	return result;
+vector<int> Partition::toLabels() const {
+	return lab;
 }
 
-void Partition::swap(Partition &other) {
-	cells.swap(other.cells);
+int Partition::splitCell(int s, int first, int last, vector<int> *trace) {
+	int end = s+length[s];
+
+	// Move the touched vertices to the end of the cell
+	int lo = end;
+	for (int i = first; i < last; i++) {
+		int u = touched[i];
+		int w = lab[--lo];
+		lab[pos[u]] = w;
+		pos[w] = pos[u];
+		lab[lo] = u;
+		pos[u] = lo;
+	}
+
+	int minCount = numeric_limits<int>::max();
+	int maxCount = 0;
+	for (int i = lo; i < end; i++) {
+		minCount = min(minCount, count[lab[i]]);
+		maxCount = max(maxCount, count[lab[i]]);
+	}
+	if (lo == s and minCount == maxCount) {
+		return 1;
+	}
+
+	// Counting sort the touched vertices by count
+	if (minCount != maxCount) {
+		split.assign(lab.begin()+lo, lab.begin()+end);
+		bucket.assign(maxCount-minCount+2, 0);
+		for (auto u = split.begin(); u != split.end(); u++) {
+			bucket[count[*u]-minCount+1]++;
+		}
+		for (int c = 0; c < maxCount-minCount+1; c++) {
+			bucket[c+1] += bucket[c];
+		}
+		for (auto u = split.begin(); u != split.end(); u++) {
+			int p = lo + bucket[count[*u]-minCount]++;
+			lab[p] = *u;
+			pos[*u] = p;
+		}
+	}
+
+	// Create the new cells
+	bool wasQueued = queued[s];
+	int pieces = 0;
+	int largest = -1;
+	if (trace != nullptr) {
+		trace->push_back(s);
+	}
+	for (int b = s, e = s; b < end; b = e) {
+		int c = (b < lo ? 0 : count[lab[b]]);
+		e = (b < lo ? lo : b+1);
+		while (e < end and count[lab[e]] == c) {
+			e++;
+		}
+
+		length[b] = e-b;
+		if (b != s) {
+			for (int i = b; i < e; i++) {
+				start[i] = b;
+			}
+			trail.push_back(b);
+		}
+		if (largest < 0 or length[b] > length[largest]) {
+			largest = b;
+		}
+		if (trace != nullptr) {
+			trace->push_back(c);
+			trace->push_back(e-b);
+		}
+		pieces++;
+	}
+	cells += pieces-1;
+
+	// Hopcroft's trick: if s was already waiting to be used as a splitter, then
+	// all of its pieces need to be. Otherwise, we can skip the largest piece.
+	for (int b = s; b < end; b += length[b]) {
+		if (not queued[b] and (wasQueued or b != largest)) {
+			queued[b] = 1;
+			alpha.push_back(b);
+		}
+	}
+	return pieces;
 }
 
-void Partition::merge(const Partition &other, int from) {
-	cells.insert(cells.end(), other.cells.begin()+from, other.cells.end());
+Orbits::Orbits() {
+	depth = -1;
+	gens = 0;
 }
 
-vector<int> Partition::toLabels() const {
-	vector<int> result;
-	for (auto cell = cells.begin(); cell != cells.end(); cell++) {
-		result.push_back(cell->back());
+Orbits::~Orbits() {
+}
+
+void Orbits::reset(int size, int depth) {
+	parent.resize(size);
+	for (int i = 0; i < size; i++) {
+		parent[i] = i;
 	}
-	return result;
+	this->depth = depth;
+	gens = 0;
 }
 
-/*vector<int> Subckt::omega(vector<vector<int> > pi) const {
-	vector<int> result;
-	for (auto cell = pi.begin(); cell != pi.end(); cell++) {
-		result.push_back((*cell)[0]);
+int Orbits::find(int v) {
+	while (parent[v] != v) {
+		parent[v] = parent[parent[v]];
+		v = parent[v];
 	}
-	return result;
+	return v;
 }
 
-vector<vector<int> > Subckt::discreteCellsOf(vector<vector<int> > pi) const {
-	vector<vector<int> > result;
-	for (int i = 0; i < (int)pi.size(); i++) {
-		if (pi[i].size() == 1) {
-			result.push_back(pi[i]);
+void Orbits::merge(const vector<int> &gamma) {
+	for (int i = 0; i < (int)gamma.size(); i++) {
+		int a = find(i);
+		int b = find(gamma[i]);
+		if (a != b) {
+			parent[max(a, b)] = min(a, b);
 		}
 	}
-	return result;
-}*/
+}
+
+Frame::Frame() {
+	ci = -1;
+	last = -1;
+	v = -1;
+	mark = 0;
+	cmp = 0;
+}
+
+Frame::~Frame() {
+}
+
+int Frame::inc(const Partition &part, Orbits &orbits) {
+	while (ci >= 0) {
+		int u = -1;
+		for (int i = ci; i < ci+part.length[ci]; i++) {
+			int w = part.lab[i];
+			if (w > last and (u < 0 or w < u)) {
+				u = w;
+			}
+		}
+		if (u < 0) {
+			return -1;
+		}
+		last = u;
+
+		bool skip = false;
+		for (auto t = tried.begin(); t != tried.end() and not skip; t++) {
+			skip = (orbits.find(*t) == orbits.find(u));
+		}
+		if (not skip) {
+			tried.push_back(u);
+			return u;
+		}
+	}
+	return -1;
+}
 
 }
@@ -6,139 +6,230 @@
 #include <unordered_set>
 #include <limits>
 #include <array>
+#include <algorithm>
 
 using namespace std;
 
 namespace sch {
 
+// An ordered partition of the vertices of a graph, stored the way nauty and
+// bliss store them. Every cell is a contiguous range of positions in lab, so
+// splitting a cell only ever rearranges the vertices inside that range.
 struct Partition {
-	using Cell = vector<int>;
-	using Cells = vector<Cell>;
-
-	Cells cells;
-
-	static Partition unit(int size);
-	static Partition discrete(int size);
+	Partition();
+	Partition(int size);
+	~Partition();
+
+	// lab[i] is the vertex at position i, and pos[v] is the position of vertex v
+	vector<int> lab;
+	vector<int> pos;
+
+	// start[i] is the first position of the cell that contains position i.
+	// length[s] is the number of vertices in the cell that starts at position
+	// s, and is only valid at the start of a cell.
+	vector<int> start;
+	vector<int> length;
+	int cells;
+
+	// Every cell that was split off of another cell, identified by its start
+	// position, in the order they were created. Use undo() to merge them back
+	// together while backtracking.
+	vector<int> trail;
+
+	// Scratch space for refine(), indexed by vertex or position. These are
+	// kept here to avoid allocating them on every call.
+	vector<int> count;
+	vector<int> touched;
+	vector<int> split;
+	vector<int> bucket;
+	vector<int> splitter;
+	vector<int> alpha;
+	vector<char> queued;
 
 	int cellOf(int v) const;
 	int next() const;
 	bool isDiscrete() const;
 	bool isDiscrete(int ci) const;
-	Partition pop(int ci, int vi);
-	void swap(Partition &other);
-	void merge(const Partition &other, int from=0);
+	int individualize(int v);
+	void undo(int mark);
 	vector<int> toLabels() const;
 
+	// Split the cell that starts at position s so that the vertices with the
+	// same value in count end up in the same cell. Only the vertices in
+	// touched[first] through touched[last-1] are moved, and those must all be
+	// in this cell with a non-zero count. The new cells are ordered by count,
+	// with the untouched vertices first. Returns the number of cells that s was
+	// split into.
+	int splitCell(int s, int first, int last, vector<int> *trace);
 
+	// Split the unit partition by Graph::color(), ordered by color.
 	template <typename Graph>
-	Partition refineCell(const Graph &g, int ci, const Partition &beta) const {
-		map<Cells, Cell> partitions;
-		for (auto v = cells[ci].begin(); v != cells[ci].end(); v++) {
-			partitions.insert(
-				pair<Cells, Cell>(
-					g.createPartitionKey(*v, beta),
-					Cell()
-				)
-			).first->second.push_back(*v);
-		}
-
-		Partition result;
-		for (auto c = partitions.begin(); c != partitions.end(); c++) {
-			result.cells.push_back(c->second);
-		}
-		return result;
+	void color(const Graph &g) {
+		int n = (int)lab.size();
+		for (int v = 0; v < n; v++) {
+			count[v] = g.color(v);
+		}
+
+		// Colors are small non-negative integers, so this is a counting sort
+		// over the whole vertex set.
+		int maxColor = 0;
+		for (int v = 0; v < n; v++) {
+			maxColor = max(maxColor, count[v]);
+		}
+		bucket.assign(maxColor+2, 0);
+		for (int v = 0; v < n; v++) {
+			bucket[count[v]+1]++;
+		}
+		for (int c = 0; c < maxColor+1; c++) {
+			bucket[c+1] += bucket[c];
+		}
+		for (int v = 0; v < n; v++) {
+			lab[bucket[count[v]]++] = v;
+		}
+
+		cells = 0;
+		for (int i = 0; i < n; i++) {
+			pos[lab[i]] = i;
+			if (i == 0 or count[lab[i]] != count[lab[i-1]]) {
+				cells++;
+				start[i] = i;
+			} else {
+				start[i] = start[i-1];
+			}
+			length[start[i]] = i+1-start[i];
+		}
+
+		for (int v = 0; v < n; v++) {
+			count[v] = 0;
+		}
 	}
 
+	// Refine this partition until it is equitable with respect to the cells in
+	// splitters, which holds the start positions of those cells.
+	// If trace is not null, every split is recorded there. The trace only
+	// depends on the structure of the graph and not on the vertex ids, so it
+	// can be used to compare nodes in the search tree.
+	//
+	// For each splitter and each edge color, this counts the number of edges
+	// from the splitter to each vertex, then splits each touched cell by that
+	// count. The work is proportional to the number of edges out of the
+	// splitter rather than the number of vertices in the graph.
 	template <typename Graph>
-	bool refine(const Graph &g, Partition alpha) {
-		bool change = false;	
-		Partition next;
-		while (not alpha.cells.empty() and not isDiscrete()) {
-			// choose arbitrary subset of alpha
-			// TODO(edward.bingham) figure out how to make this choice so as to speed up convergence.
-			Partition beta;
-			beta.cells.push_back(alpha.cells.back());
-			alpha.cells.pop_back();
-
-			for (int i = 0; i < (int)cells.size(); i++) {
-				Partition refined = refineCell(g, i, beta);
-				next.merge(refined);
-				if (refined.cells.size() > 1) {
-					alpha.merge(refined, 1);
-					change = true;
+	bool refine(const Graph &g, const vector<int> &splitters, vector<int> *trace=nullptr) {
+		alpha.assign(splitters.begin(), splitters.end());
+		for (auto a = alpha.begin(); a != alpha.end(); a++) {
+			queued[*a] = 1;
+		}
+
+		int before = cells;
+		for (int head = 0; head < (int)alpha.size() and not isDiscrete(); head++) {
+			int w = alpha[head];
+			queued[w] = 0;
+			// The splitter may itself be split while we use it, so take a copy.
+			splitter.assign(lab.begin()+w, lab.begin()+w+length[w]);
+
+			for (int c = 0; c < g.colors(); c++) {
+				touched.clear();
+				for (auto v = splitter.begin(); v != splitter.end(); v++) {
+					g.adjacent(*v, c, [&](int u) {
+						if (count[u]++ == 0) {
+							touched.push_back(u);
+						}
+					});
+				}
+				if (touched.empty()) {
+					continue;
+				}
+
+				// Group the touched vertices by cell. The cells must be split in
+				// position order so that the order of alpha doesn't depend on
+				// the vertex ids.
+				sort(touched.begin(), touched.end(), [&](int a, int b) {
+					return pos[a] < pos[b];
+				});
+
+				for (int i = 0, j = 0; i < (int)touched.size(); i = j) {
+					int s = start[pos[touched[i]]];
+					j = i+1;
+					while (j < (int)touched.size() and start[pos[touched[j]]] == s) {
+						j++;
+					}
+					if (length[s] > 1) {
+						int pieces = splitCell(s, i, j, trace);
+						if (trace != nullptr and pieces > 1) {
+							trace->push_back(w);
+							trace->push_back(c);
+						}
+					}
+				}
+
+				for (auto u = touched.begin(); u != touched.end(); u++) {
+					count[*u] = 0;
 				}
 			}
-			cells.swap(next.cells);
-			next.cells.clear();
 		}
-		return change;
+
+		for (auto a = alpha.begin(); a != alpha.end(); a++) {
+			queued[*a] = 0;
+		}
+		return cells != before;
 	}
 };
 
-struct Frame {
-	Frame() {}
+// The orbits of a group of automorphisms, stored as a union-find structure
+// over the vertices.
+struct Orbits {
+	Orbits();
+	~Orbits();
 
-	template <typename Graph>
-	Frame(const Graph &g) {
-		part = Partition::unit(g.verts());
-		part.refine(g, part);
-		ci = part.next();
-		vi = 0;
-		
-		v = -1;
-	}
+	vector<int> parent;
 
-	~Frame() {}
+	// The depth in the search tree that these orbits were computed for, and
+	// the number of automorphisms that have been merged in so far.
+	int depth;
+	int gens;
 
-	Partition part;
+	void reset(int size, int depth);
+	int find(int v);
+	void merge(const vector<int> &gamma);
+};
+
+// One node in the search tree. The partition itself isn't stored here. The
+// search refines a single partition in place and uses Partition::undo() to
+// get back to this node.
+struct Frame {
+	Frame();
+	~Frame();
+
+	// The start position of the cell we are individualizing vertices from, and
+	// the last vertex in that cell that we tried.
 	int ci;
-	int vi;
+	int last;
 	
+	// The vertex that was individualized to create this frame
 	int v;
 
-	vector<array<int, 4> > l;
+	// The length of Partition::trail at this node
+	int mark;
 
-	bool inc() {
-		v = part.cells[ci][vi];
-		return (++vi < (int)part.cells[ci].size());
-	}
+	// The refinement trace from individualizing v
+	vector<int> trace;
 
-	template <typename Graph>
-	bool pop(const Graph &g) {
-		if (part.refine(g, part.pop(ci, vi)) or part.isDiscrete(ci)) {
-			ci = part.next();
-		}
-		vi = 0;
+	// Comparison between the traces along the path to this frame and the path
+	// to the best leaf found so far. 1 if this path is better, 0 if they are
+	// the same.
+	int cmp;
 
-		l = g.lambda(part);
-		return ci < 0;
-	}
+	// The children of this frame that have already been explored
+	vector<int> tried;
 
-	template <typename Graph>
-	bool isLessThan(const Graph &g, const Frame &frame) const {
-		int m = (int)min(l.size(), frame.l.size());
-		for (int i = 0; i < m; i++) {
-			for (int j = 0; j < 4; j++) {
-				if (l[i][j] < frame.l[i][j]) {
-					return false;
-				} else if (l[i][j] > frame.l[i][j]) {
-					return true;
-				}
-			}
-		}
-
-		if (not part.isDiscrete() or not frame.part.isDiscrete()) {
-			return false;
-		}
-		return g.comparePartitions(part, frame.part) == -1;
-	}
+	// Find the next child to explore in increasing order of vertex id,
+	// skipping any vertex that is in the same orbit as a child we have already
+	// explored. Those subtrees are mapped onto each other by an automorphism,
+	// so they contain the same leaves. Returns -1 if there are none left.
+	int inc(const Partition &part, Orbits &orbits);
 };
 
-//vector<int> omega(vector<vector<int> > pi) const;
-//vector<vector<int> > discreteCellsOf(vector<vector<int> > pi) const;
-
-
-
 // This function will be derived from Nauty, Bliss, and DviCL
 //
 // B.D. McKay: Computing automorphisms and canonical labellings of
@@ -157,68 +248,162 @@ struct Frame {
 //
 // TODO(edward.bingham) implement optimizations from nauty, bliss, and dvicl
 //
+// Orbit pruning of automorphic branches is already implemented, see Orbits.
+//
 // struct Graph {
-//   // Used to refine partitions (required)
-//   vector<vector<int> > createPartitionKey(int v, const vector<vector<int> > &beta) const;
+//   int verts() const;
+//
+//   // Used to create the initial partition (required). Vertices with
+//   // different colors are never mapped onto each other.
+//   int color(int v) const;
 //
-//   // Used to identify canonical labelings (required)
-//   int comparePartitions(const vector<vector<int> > &pi0, const vector<vector<int> > &pi1) const;
+//   // Used to refine partitions (required). Calls visit(u) for every edge of
+//   // color c from v to u. Edge colors are 0 through colors()-1.
+//   int colors() const;
+//   template <typename Visit>
+//   void adjacent(int v, int c, Visit visit) const;
 //
-//   // Used to prune the search tree (optional)
-//   vector<array<int, 4> > lambda(vector<vector<int> > pi) const;
+//   // Used to identify canonical labelings (required). pi0 and pi1 are
+//   // discrete.
+//   int comparePartitions(const Partition &pi0, const Partition &pi1) const;
 // };
+//
+// If gens is not null, it is filled with the automorphisms that the search
+// found along the way, each mapping every vertex to its image.
 
 template <typename Graph>
-vector<int> canonicalLabels(const Graph &g) {
-	// TODO(edward.bingham) map discreteCellsOf() -> omega() and use this to
-	// prune automorphisms from the search tree.
-	// map<vector<int>, vector<int> > stored;
-
-	vector<Frame> best;
-	vector<Frame> frames(1, Frame(g));
-	if (frames.back().part.isDiscrete()) {
-		best = frames;
-		frames.pop_back();
+vector<int> canonicalLabels(const Graph &g, vector<vector<int> > *gens=nullptr) {
+	Partition part(g.verts());
+	part.color(g);
+	vector<int> alpha;
+	for (int i = 0; i < (int)part.lab.size(); i += part.length[i]) {
+		alpha.push_back(i);
+	}
+	part.refine(g, alpha);
+
+	vector<Frame> frames(1, Frame());
+	frames.back().ci = part.next();
+	frames.back().mark = (int)part.trail.size();
+	if (frames.back().ci < 0) {
+		if (gens != nullptr) {
+			gens->clear();
+		}
+		return part.toLabels();
 	}
 
-	int explored = 0;
+	// The labeling at the best leaf found so far, the vertices that were
+	// individualized to get there, and the refinement trace of each frame
+	// along the way. Leaves are ordered first by those traces, then by
+	// comparePartitions(). Both only depend on the structure of the graph, so
+	// the best leaf is a canonical labeling.
+	bool found = false;
+	Partition best;
+	vector<int> bestPath;
+	vector<vector<int> > bestTrace;
+
+	// Each automorphism maps every vertex to its image. orbits is only kept
+	// for the frame we are currently expanding.
+	vector<vector<int> > automorphisms;
+	Orbits orbits;
+
+	// path[i] is the vertex that was individualized to create frames[i+1]
+	vector<int> path;
+	Frame next;
 	while (not frames.empty()) {
-		Frame next = frames.back();
-		if (not frames.back().inc()) {
-			frames.pop_back();
+		int depth = (int)frames.size()-1;
+		part.undo(frames.back().mark);
+
+		// Bring the orbits up to date with the automorphisms that fix every
+		// vertex along the path to this frame.
+		if (orbits.depth != depth) {
+			orbits.reset((int)part.lab.size(), depth);
+		}
+		for (; orbits.gens < (int)automorphisms.size(); orbits.gens++) {
+			const vector<int> &gamma = automorphisms[orbits.gens];
+			bool fixed = true;
+			for (auto p = path.begin(); p != path.end() and fixed; p++) {
+				fixed = (gamma[*p] == *p);
+			}
+			if (fixed) {
+				orbits.merge(gamma);
+			}
 		}
 
-		/*for (auto p = next.part.begin(); p != next.part.end(); p++) {
-			if (not is_sorted(p->begin(), p->end())) {
-				printf("violation of sorting assumption\n");
+		next.v = frames.back().inc(part, orbits);
+		if (next.v < 0) {
+			frames.pop_back();
+			if (not path.empty()) {
+				path.pop_back();
 			}
-		}*/
-
-		if (next.pop(g)) {
-			// found a discrete partition
-			explored++;
-			// found terminal node in tree
-			int cmp = best.empty() ? 1 : g.comparePartitions(next.part, best.back().part);
-			if (cmp == 1) {
-				best = frames;
-				best.push_back(next);
-			} else if (cmp == 0) {
-				// We found an automorphism. We can use this to prune the search space.
-				// Find a shared node in the frames list between best and next
-				int from = 0;
-				while (from < (int)frames.size()
-					and from < (int)best.size()
-					and frames[from].v == best[from].v) {
-					from++;
-				}
-				frames.resize(from);
+			continue;
+		}
+
+		next.trace.clear();
+		alpha.assign(1, part.individualize(next.v));
+		part.refine(g, alpha, &next.trace);
+		next.ci = part.next();
+		next.last = -1;
+		next.mark = (int)part.trail.size();
+		next.cmp = frames.back().cmp;
+		next.tried.clear();
+		if (not found) {
+			next.cmp = 1;
+		} else if (next.cmp == 0) {
+			if (depth >= (int)bestTrace.size() or next.trace > bestTrace[depth]) {
+				next.cmp = 1;
+			} else if (next.trace < bestTrace[depth]) {
+				// Every leaf under this node is worse than the best leaf
+				continue;
 			}
-		} else if (best.empty() or not next.isLessThan(g, best.back())) {
+		}
+
+		if (next.ci >= 0) {
+			path.push_back(next.v);
 			frames.push_back(next);
+			continue;
+		}
+
+		// found a discrete partition
+		int cmp = next.cmp == 0 ? g.comparePartitions(part, best) : 1;
+		if (cmp == 1) {
+			found = true;
+			best.lab = part.lab;
+			best.pos = part.pos;
+			bestPath = path;
+			bestPath.push_back(next.v);
+			bestTrace.clear();
+			for (auto f = frames.begin()+1; f != frames.end(); f++) {
+				bestTrace.push_back(f->trace);
+				f->cmp = 0;
+			}
+			bestTrace.push_back(next.trace);
+		} else if (cmp == 0) {
+			// We found an automorphism. Record it so that the frames can prune
+			// children by orbit.
+			vector<int> gamma(part.lab.size(), -1);
+			for (int i = 0; i < (int)part.lab.size(); i++) {
+				gamma[part.lab[i]] = best.lab[i];
+			}
+			automorphisms.push_back(gamma);
+
+			// The automorphism maps the subtree under the first node at which
+			// this path diverges from the path to the best leaf onto a subtree
+			// we have already explored, so we can backtrack to that node.
+			int from = 0;
+			while (from < (int)path.size()
+				and from < (int)bestPath.size()
+				and path[from] == bestPath[from]) {
+				from++;
+			}
+			frames.resize(from+1);
+			path.resize(from);
 		}
 	}
 
-	return best.back().part.toLabels();
+	if (gens != nullptr) {
+		std::swap(*gens, automorphisms);
+	}
+	return best.toLabels();
 }
 
 }
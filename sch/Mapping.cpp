@@ -196,11 +196,11 @@ Mapping Segment::generate(Subckt &dst, const Subckt &src) const {
 	for (int i = 0; i < (int)m1.nets.size(); i++) {
 		if (m1.nets[i] >= 0) {
 			if (dst.nets[i].isIO and dst.nets[i].isOutput()) {
-				dst.nets[i].name = "o" + to_string(i);
+				dst.renameNet(i, "o" + to_string(i));
 			} else if (dst.nets[i].isIO and dst.nets[i].isInput()) {
-				dst.nets[i].name = "i" + to_string(i);
+				dst.renameNet(i, "i" + to_string(i));
 			} else if (not dst.nets[i].isIO) {
-				dst.nets[i].name = "_" + to_string(i);
+				dst.renameNet(i, "_" + to_string(i));
 			}
 		}
 	}
@@ -2,8 +2,10 @@
 #include "Draw.h"
 #include "Placer.h"
 #include "Router.h"
+#include "Parallel.h"
 
 #include <chrono>
+#include <algorithm>
 #define KNRM  "\x1B[0m"
 #define KRED  "\x1B[31m"
 #define KGRN  "\x1B[32m"
@@ -15,6 +17,47 @@ using namespace std;
 
 namespace sch {
 
+CellTable::CellTable(int shards) : shards(shards) {
+}
+
+CellTable::~CellTable() {
+}
+
+CellTable::Entry *CellTable::insert(const Subckt *cell, array<int, 2> order) {
+	Shard &shard = shards[cell->id%shards.size()];
+	lock_guard<mutex> guard(shard.lock);
+
+	list<Entry> &bucket = shard.cells[cell->id];
+	for (auto e = bucket.begin(); e != bucket.end(); e++) {
+		if (*e->cell == *cell) {
+			// Keep the cell that the serial mapping would have inserted so the
+			// result doesn't depend on which worker got here first.
+			if (order < e->order) {
+				e->order = order;
+				e->cell = cell;
+			}
+			return &*e;
+		}
+	}
+	bucket.push_back(Entry{order, cell, -1});
+	return &bucket.back();
+}
+
+vector<CellTable::Entry*> CellTable::entries() {
+	vector<Entry*> result;
+	for (auto shard = shards.begin(); shard != shards.end(); shard++) {
+		for (auto bucket = shard->cells.begin(); bucket != shard->cells.end(); bucket++) {
+			for (auto e = bucket->second.begin(); e != bucket->second.end(); e++) {
+				result.push_back(&*e);
+			}
+		}
+	}
+	sort(result.begin(), result.end(), [](const Entry *e0, const Entry *e1) {
+		return e0->order < e1->order;
+	});
+	return result;
+}
+
 Netlist::Netlist(const Tech &tech) {
 	this->tech = &tech;
 }
@@ -74,7 +117,12 @@ void Netlist::erase(int idx) {
 	subckts.erase(subckts.begin()+idx);
 }
 
-void Netlist::mapCells(bool progress) {
+void Netlist::mapCells(bool progress, int threads) {
+	if (threadCount(threads) > 1) {
+		mapCellsParallel(progress, threadCount(threads));
+		return;
+	}
+
 	// check existing cells
 	for (int i = (int)subckts.size()-1; i >= 0; i--) {
 		if (subckts[i].isCell and not subckts[i].mos.empty()) {
@@ -145,6 +193,122 @@ void Netlist::mapCells(bool progress) {
 	}
 }
 
+// The expensive part of mapCells() is segmenting and canonicalizing each
+// subckt, and that only ever touches the subckt itself. So we do that work on a
+// pool of workers, deduplicating the generated cells through a sharded
+// CellTable. Then we number the unique cells in the order that the serial
+// implementation would have found them, so the resulting netlist is identical
+// regardless of the number of threads.
+void Netlist::mapCellsParallel(bool progress, int threads) {
+	// check existing cells
+	vector<int> existing;
+	for (int i = (int)subckts.size()-1; i >= 0; i--) {
+		if (subckts[i].isCell and not subckts[i].mos.empty()) {
+			existing.push_back(i);
+		}
+	}
+	parallelFor((int)existing.size(), threads, [&](int k) {
+		subckts[existing[k]].canonicalize();
+	});
+	for (auto i = existing.begin(); i != existing.end(); i++) {
+		insert(*i);
+	}
+
+	// break large subckts into new cells
+	if (progress) {
+		printf("Break subckts into cells:\n");
+	}
+	steady_clock::time_point start = steady_clock::now();
+
+	vector<int> todo;
+	for (int i = (int)subckts.size()-1; i >= 0; i--) {
+		if (not subckts[i].isCell and not subckts[i].mos.empty()) {
+			todo.push_back(i);
+		}
+	}
+
+	struct Mapped {
+		// the canonical cells generated from each segment
+		vector<Subckt> cells;
+		// index into Subckt::inst of the instance of each cell
+		vector<int> inst;
+		// the mapping from each cell's nets to the nets of the subckt
+		vector<Mapping> maps;
+		vector<CellTable::Entry*> entries;
+	};
+
+	CellTable table;
+	vector<Mapped> mapped(todo.size());
+	parallelFor((int)todo.size(), threads, [&](int k) {
+		Subckt &ckt = subckts[todo[k]];
+		Mapped &result = mapped[k];
+
+		auto segments = ckt.segment();
+		result.cells.reserve(segments.size());
+		for (auto s = segments.begin(); s != segments.end(); s++) {
+			result.cells.push_back(Subckt(true));
+			Subckt &cell = result.cells.back();
+			Mapping m = s->generate(cell, ckt);
+			m.apply(cell.canonicalize());
+			cell.name = "cell_" + idToString(cell.id);
+
+			ckt.extract(*s);
+			// The index into Netlist::subckts is assigned once all of the unique
+			// cells have been found.
+			result.inst.push_back((int)ckt.inst.size());
+			ckt.pushInst(Instance(cell, m, -1));
+			result.maps.push_back(m);
+
+			for (auto s1 = s+1; s1 != segments.end(); s1++) {
+				// See the DESIGN note in the serial implementation.
+				if (not s1->extract(*s)) {
+					printf("internal %s:%d: overlapping cells found\n", __FILE__, __LINE__);
+				}
+			}
+		}
+
+		ckt.cleanDangling();
+
+		result.entries.reserve(result.cells.size());
+		for (int j = 0; j < (int)result.cells.size(); j++) {
+			result.entries.push_back(table.insert(&result.cells[j], {k, j}));
+		}
+	});
+
+	// number the unique cells
+	vector<int> created(todo.size(), 0);
+	vector<CellTable::Entry*> unique = table.entries();
+	for (auto e = unique.begin(); e != unique.end(); e++) {
+		int count = (int)subckts.size();
+		(*e)->index = insert(*(*e)->cell);
+		created[(*e)->order[0]] += ((*e)->index >= count);
+	}
+
+	for (int k = 0; k < (int)todo.size(); k++) {
+		Subckt &ckt = subckts[todo[k]];
+		for (int j = 0; j < (int)mapped[k].inst.size(); j++) {
+			// The cell this was deduplicated against may list the same ports in a
+			// different order, so the ports are taken from that one. They connect
+			// the same nets, so Net::portOf doesn't change.
+			int index = mapped[k].entries[j]->index;
+			ckt.inst[mapped[k].inst[j]] = Instance(subckts[index], mapped[k].maps[j], index);
+		}
+
+		if (progress) {
+			printf("  %s...[%s%d UNIQUE/%d CELLS%s]\n", ckt.name.c_str(), KGRN, created[k], (int)mapped[k].cells.size(), KNRM);
+		}
+
+		if (not ckt.mos.empty()) {
+			printf("failed to segment all devices\n");
+		}
+	}
+
+	steady_clock::time_point finish = steady_clock::now();
+	if (progress) {
+		printf("done [%gs]\n\n", ((float)duration_cast<milliseconds>(finish - start).count())/1000.0);
+	}
+}
+
 string idToString(size_t id) {
 	// spice names are not sensitive to capitalization, and only support alphanum
 	// characters. Not enough character types to support base64.
@@ -7,11 +7,44 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <list>
+#include <mutex>
+#include <array>
 
 using namespace std;
 
 namespace sch {
 
+// This is a thread-safe index from Subckt::id to the unique cells found while
+// mapping subckts in parallel. Entries are split into shards by id so that
+// workers canonicalizing different cells rarely contend for the same lock.
+struct CellTable {
+	CellTable(int shards=64);
+	~CellTable();
+
+	struct Entry {
+		// The position at which a serial mapping would have first encountered
+		// this cell: [subckt, segment] in the order they are visited by
+		// Netlist::mapCells(). Keeping the minimum makes the final numbering of
+		// unique cells independent of the number of threads.
+		array<int, 2> order;
+		const Subckt *cell;
+
+		// index into Netlist::subckts, assigned after all workers finish
+		int index;
+	};
+
+	struct Shard {
+		mutex lock;
+		map<size_t, list<Entry> > cells;
+	};
+
+	vector<Shard> shards;
+
+	Entry *insert(const Subckt *cell, array<int, 2> order);
+	vector<Entry*> entries();
+};
+
 struct Netlist {
 	Netlist(const Tech &tech);
 	~Netlist();
@@ -25,7 +58,8 @@ struct Netlist {
 	int insert(const Subckt &cell);
 	void erase(int idx);
 
-	void mapCells(bool progress=false);
+	void mapCells(bool progress=false, int threads=1);
+	void mapCellsParallel(bool progress, int threads);
 };
 
 string idToString(size_t id);
@@ -0,0 +1,44 @@
+#include "Parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace sch {
+
+int threadCount(int threads) {
+	if (threads < 1) {
+		threads = (int)std::thread::hardware_concurrency();
+	}
+	return threads < 1 ? 1 : threads;
+}
+
+void parallelFor(int count, int threads, const function<void(int)> &fn) {
+	threads = min(threadCount(threads), count);
+	if (threads <= 1) {
+		for (int i = 0; i < count; i++) {
+			fn(i);
+		}
+		return;
+	}
+
+	atomic<int> next(0);
+	auto worker = [&]() {
+		for (int i = next++; i < count; i = next++) {
+			fn(i);
+		}
+	};
+
+	vector<std::thread> pool;
+	pool.reserve(threads-1);
+	for (int i = 0; i < threads-1; i++) {
+		pool.push_back(std::thread(worker));
+	}
+	worker();
+	for (auto t = pool.begin(); t != pool.end(); t++) {
+		t->join();
+	}
+}
+
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <functional>
+
+using namespace std;
+
+namespace sch {
+
+// Resolve a requested thread count. Anything less than one means "use every
+// core on this machine".
+int threadCount(int threads);
+
+// Run fn(0) through fn(count-1) across a pool of worker threads. Work items
+// are claimed in increasing index order, so callers that want the expensive
+// items to start first should sort their work before calling this. If
+// threads is one, everything runs on the calling thread.
+void parallelFor(int count, int threads, const function<void(int)> &fn);
+
+}
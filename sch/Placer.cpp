@@ -1,5 +1,6 @@
 #include "Placer.h"
 #include "Draw.h"
+#include "Parallel.h"
 
 #include <list>
 #include <set>
@@ -9,6 +10,61 @@
 
 namespace sch {
 
+// The nets on either side of a device as it is placed in the stack, see
+// Mos::left() and Mos::right()
+static inline int leftOf(const vector<int> &pins, Device d) {
+	return pins[d.device*3 + 1 + (int)d.flip];
+}
+
+static inline int rightOf(const vector<int> &pins, Device d) {
+	return pins[d.device*3 + 2 - (int)d.flip];
+}
+
+static inline bool hasBreak(const vector<int> &pins, Device d0, Device d1) {
+	return d0.device >= 0 and d1.device >= 0 and rightOf(pins, d0) != leftOf(pins, d1);
+}
+
+static inline Device flipped(Device d) {
+	d.flip = not d.flip;
+	return d;
+}
+
+// The number of diffusion breaks needed to make the diffusion graph of one
+// stack semi-Eulerian, assuming that it is connected. This is -1 if every net
+// has an even number of ports.
+static int minBreaks(const Subckt &ckt, int type) {
+	int result = -2;
+	for (auto n = ckt.nets.begin(); n != ckt.nets.end(); n++) {
+		result += (n->ports(type)&1);
+	}
+	return result >> 1;
+}
+
+// A lower bound on L for any placement of ckt whose stacks have the given
+// size. Within one stack each gate on a net needs its own column, and each
+// contact is shared by at most two terminals. Gates are at odd positions and
+// contacts at even ones, so see Placement::update() for how L adds them up.
+static int minLength(const Subckt &ckt, int size) {
+	int result = 0;
+	for (auto n = ckt.nets.begin(); n != ckt.nets.end(); n++) {
+		int gates = 0;
+		int contacts = 0;
+		for (int type = 0; type < 2; type++) {
+			gates = max(gates, (int)n->gateOf[type].size());
+			contacts = max(contacts, (int)(n->sourceOf[type].size() + n->drainOf[type].size() + 1)/2);
+		}
+
+		if (gates == 0 and contacts == 0) {
+			result += -1 - 2*(size+1);
+		} else if (gates == 0 or contacts == 0) {
+			result += 2*(max(gates, contacts)-1);
+		} else {
+			result += max(gates+contacts-1, 2*(max(gates, contacts)-1));
+		}
+	}
+	return result;
+}
+
 Placement::Placement(const Subckt &ckt, int b, int l, int w, int g, std::default_random_engine &rand) : ckt(ckt) {
 	this->b = b;
 	this->l = l;
@@ -16,7 +72,7 @@ Placement::Placement(const Subckt &ckt, int b, int l, int w, int g, std::default
 	this->g = g;
 
 	// fill stacks with devices that have random orientiations
-	static std::bernoulli_distribution distribution(0.5);
+	std::bernoulli_distribution distribution(0.5);
 	for (int i = 0; i < (int)ckt.mos.size(); i++) {
 		stack[ckt.mos[i].type].push_back(Device{i, distribution(rand)});
 	}
@@ -27,11 +83,7 @@ Placement::Placement(const Subckt &ckt, int b, int l, int w, int g, std::default
 	// compute Wmin
 	array<int, 2> D;
 	for (int type = 0; type < 2; type++) {
-		D[type] = -2;
-		for (int i = 0; i < (int)ckt.nets.size(); i++) {
-			D[type] += (ckt.nets[i].ports(type)&1);
-		}
-		D[type] >>= 1;
+		D[type] = minBreaks(ckt, type);
 	}
 	this->Wmin = max((int)stack[0].size()+D[0], (int)stack[1].size()+D[1]) - max((int)stack[0].size(), (int)stack[1].size());
 
@@ -43,6 +95,8 @@ Placement::Placement(const Subckt &ckt, int b, int l, int w, int g, std::default
 	for (int type = 0; type < 2; type++) {
 		shuffle(stack[type].begin(), stack[type].end(), rand);
 	}
+
+	update();
 }
 
 Placement::~Placement() {
@@ -56,9 +110,410 @@ Placement::Placement(const Placement &p) : ckt(p.ckt) {
 	this->Wmin = p.Wmin;
 	this->d = p.d;
 	this->stack = p.stack;
+	this->pins = p.pins;
+	this->breaks = p.breaks;
+	this->brk = p.brk;
+	this->ext = p.ext;
+	this->L = p.L;
+	this->align = p.align;
+	this->tail = p.tail;
+	this->G = p.G;
+	this->span = p.span;
+}
+
+void Placement::euler(std::default_random_engine &rand) {
+	// adj[type][net] lists the devices that have their source or drain on net
+	array<vector<vector<int> >, 2> adj;
+	array<int, 2> remaining = {0, 0};
+	for (int type = 0; type < 2; type++) {
+		adj[type].resize(ckt.nets.size());
+	}
+	for (int i = 0; i < (int)ckt.mos.size(); i++) {
+		const Mos &m = ckt.mos[i];
+		adj[m.type][m.source].push_back(i);
+		if (m.drain != m.source) {
+			adj[m.type][m.drain].push_back(i);
+		}
+		remaining[m.type]++;
+	}
+
+	vector<char> used(ckt.mos.size(), false);
+	auto across = [&](int dev, int net) {
+		return ckt.mos[dev].source == net ? ckt.mos[dev].drain : ckt.mos[dev].source;
+	};
+
+	// Fleury's algorithm: taking dev from net would strand the rest of the
+	// trail unless the other side of dev can still be reached from net.
+	vector<char> seen(ckt.nets.size(), false);
+	vector<int> frontier;
+	auto isBridge = [&](int type, int dev, int net) {
+		int to = across(dev, net);
+		seen.assign(ckt.nets.size(), false);
+		frontier.assign(1, net);
+		seen[net] = true;
+		while (not frontier.empty()) {
+			int curr = frontier.back();
+			frontier.pop_back();
+			for (auto e = adj[type][curr].begin(); e != adj[type][curr].end(); e++) {
+				int next = across(*e, curr);
+				if (not used[*e] and *e != dev and not seen[next]) {
+					if (next == to) {
+						return false;
+					}
+					seen[next] = true;
+					frontier.push_back(next);
+				}
+			}
+		}
+		return true;
+	};
+
+	// A new trail has to start at a net with an odd number of remaining
+	// ports if there is one, otherwise we'd need yet another break later.
+	auto startOf = [&](int type) {
+		vector<int> odd, any;
+		for (int net = 0; net < (int)ckt.nets.size(); net++) {
+			int degree = 0;
+			for (auto e = adj[type][net].begin(); e != adj[type][net].end(); e++) {
+				degree += (not used[*e]);
+			}
+			if (degree > 0) {
+				any.push_back(net);
+				if (degree&1) {
+					odd.push_back(net);
+				}
+			}
+		}
+		vector<int> &from = odd.empty() ? any : odd;
+		return from[rand()%from.size()];
+	};
+
+	array<int, 2> at = {-1, -1};
+	array<vector<int>, 2> options;
+	vector<vec2i> pairs;
+	for (int type = 0; type < 2; type++) {
+		stack[type].clear();
+	}
+	while (remaining[0] > 0 or remaining[1] > 0) {
+		for (int type = 0; type < 2; type++) {
+			options[type].clear();
+			if (remaining[type] == 0) {
+				continue;
+			}
+
+			bool stuck = (at[type] < 0);
+			if (not stuck) {
+				stuck = true;
+				for (auto e = adj[type][at[type]].begin(); e != adj[type][at[type]].end() and stuck; e++) {
+					stuck = used[*e];
+				}
+			}
+			if (stuck) {
+				at[type] = startOf(type);
+			}
+
+			int bridges = 0;
+			for (auto e = adj[type][at[type]].begin(); e != adj[type][at[type]].end(); e++) {
+				if (not used[*e]) {
+					if (isBridge(type, *e, at[type])) {
+						options[type].push_back(*e);
+						bridges++;
+					} else {
+						options[type].insert(options[type].end()-bridges, *e);
+					}
+				}
+			}
+			// Only cross a bridge if there is nothing else to take
+			if (bridges < (int)options[type].size()) {
+				options[type].resize(options[type].size()-bridges);
+			}
+		}
+
+		pairs.clear();
+		for (auto n = options[0].begin(); n != options[0].end(); n++) {
+			for (auto p = options[1].begin(); p != options[1].end(); p++) {
+				if (ckt.mos[*n].gate == ckt.mos[*p].gate) {
+					pairs.push_back(vec2i(*n, *p));
+				}
+			}
+		}
+
+		array<int, 2> pick = {-1, -1};
+		if (not pairs.empty()) {
+			vec2i pair = pairs[rand()%pairs.size()];
+			pick[0] = pair[0];
+			pick[1] = pair[1];
+		} else {
+			for (int type = 0; type < 2; type++) {
+				if (not options[type].empty()) {
+					pick[type] = options[type][rand()%options[type].size()];
+				}
+			}
+		}
+
+		for (int type = 0; type < 2; type++) {
+			if (pick[type] >= 0) {
+				stack[type].push_back(Device{pick[type], ckt.mos[pick[type]].source != at[type]});
+				used[pick[type]] = true;
+				remaining[type]--;
+				at[type] = across(pick[type], at[type]);
+			}
+		}
+	}
+
+	bool shorter = stack[1].size() < stack[0].size();
+	stack[shorter].resize(stack[not shorter].size(), Device{-1,false});
+
+	update();
+}
+
+// Rebuild all of the cached terms of the cost function from scratch
+void Placement::update() {
+	pins.clear();
+	pins.reserve(ckt.mos.size()*3);
+	for (auto m = ckt.mos.begin(); m != ckt.mos.end(); m++) {
+		pins.push_back(m->gate);
+		pins.push_back(m->source);
+		pins.push_back(m->drain);
+	}
+
+	for (int type = 0; type < 2; type++) {
+		breaks[type].assign(stack[type].size(), false);
+		brk[type] = 0;
+		for (int i = 1; i < (int)stack[type].size(); i++) {
+			breaks[type][i] = hasBreak(pins, stack[type][i-1], stack[type][i]);
+			brk[type] += breaks[type][i];
+		}
+	}
+
+	vec2i empty(((int)stack[0].size()+1)*2, -1);
+	ext.assign(ckt.nets.size(), empty);
+	for (int type = 0; type < 2; type++) {
+		for (int i = 0; i < (int)stack[type].size(); i++) {
+			const Device &c = stack[type][i];
+			if (c.device >= 0) {
+				const int *p = pins.data() + c.device*3;
+				int off = i<<1;
+				int pos[3] = {off+1, off+2*((int)(not c.flip)), off+2*((int)c.flip)};
+				for (int k = 0; k < 3; k++) {
+					ext[p[k]][0] = min(ext[p[k]][0], pos[k]);
+					ext[p[k]][1] = max(ext[p[k]][1], pos[k]);
+				}
+			}
+		}
+	}
+
+	L = 0;
+	for (auto e = ext.begin(); e != ext.end(); e++) {
+		L += (*e)[1] - (*e)[0];
+	}
+
+	span.assign(ckt.nets.size(), empty);
+	touched.clear();
+
+	updateAlignment();
+}
+
+// Redo the gate alignment walk that computes G and record each step in align
+// and tail
+void Placement::updateAlignment() {
+	int size = (int)stack[0].size();
+	align.assign(size, -1);
+	tail.assign(size, 0);
+
+	int i = 0, j = 0;
+	while (i < size and j < (int)stack[1].size()) {
+		int si = i;
+		align[si] = j;
+
+		if (breaks[0][i] and not breaks[1][j]) {
+			j++;
+		} else if (breaks[1][j] and not breaks[0][i]) {
+			i++;
+		}
+
+		if (i == size or j == (int)stack[1].size()) {
+			break;
+		}
+
+		int n = stack[0][i].device;
+		int p = stack[1][j].device;
+		tail[si] = (n >= 0 and p >= 0 and pins[n*3] != pins[p*3]);
+		i++;
+		j++;
+	}
+
+	G = 0;
+	for (int t = size-1; t >= 0; t--) {
+		if (align[t] >= 0) {
+			G += tail[t];
+			tail[t] = G;
+		}
+	}
+}
+
+// Flipping a range reverses the devices in it and swaps their sides, so the
+// breaks inside of the range are just mirrored. Only the breaks at either
+// edge of the range can change. This returns whether there would be a break
+// between stack[type][i-1] and stack[type][i] after move(choice).
+bool Placement::breakAfter(vec4i choice, int type, int i) const {
+	int lo = choice[2], hi = choice[3];
+	if (type < choice[0] or type >= choice[1] or i < lo or i > hi+1) {
+		return breaks[type][i];
+	}
+
+	const vector<Device> &s = stack[type];
+	if (i == lo) {
+		return i > 0 and hasBreak(pins, s[i-1], flipped(s[hi]));
+	} else if (i == hi+1) {
+		return hasBreak(pins, flipped(s[lo]), s[i]);
+	}
+	return breaks[type][lo+hi+1-i];
+}
+
+// Find the first and last position of every net with a terminal in the range
+// selected by choice as if the range had been flipped. This looks at both
+// stacks because only one of them might be flipped, and at the devices just
+// outside of the range because they share a position with it.
+void Placement::findSpans(vec4i choice) {
+	int lo = choice[2], hi = choice[3];
+	// every net is written to the end of touched, but only kept the first time
+	touched.resize(ckt.nets.size()+1);
+	int count = 0;
+	auto widen = [&](int net, int x) {
+		vec2i &sp = span[net];
+		touched[count] = net;
+		count += (sp[1] < 0);
+		sp[0] = min(sp[0], x);
+		sp[1] = max(sp[1], x);
+	};
+
+	for (int type = 0; type < 2; type++) {
+		const vector<Device> &s = stack[type];
+
+		// flipping the range mirrors every position in it
+		bool flip = (type >= choice[0] and type < choice[1]);
+		int base = flip ? 2*(lo+hi)+2 : 0;
+		int sign = flip ? -1 : 1;
+		for (int i = lo; i <= hi; i++) {
+			if (s[i].device >= 0) {
+				const int *p = pins.data() + s[i].device*3;
+				int off = base + sign*(i<<1);
+				widen(p[0], off + sign);
+				widen(p[1], off + sign*2*((int)(not s[i].flip)));
+				widen(p[2], off + sign*2*((int)s[i].flip));
+			}
+		}
+
+		// These use the same terminal positions as update()
+		if (lo > 0 and s[lo-1].device >= 0) {
+			widen(pins[s[lo-1].device*3 + (s[lo-1].flip ? 2 : 1)], 2*lo);
+		}
+		if (hi+1 < (int)s.size() and s[hi+1].device >= 0) {
+			widen(pins[s[hi+1].device*3 + (s[hi+1].flip ? 1 : 2)], 2*hi+2);
+		}
+	}
+	touched.resize(count);
+}
+
+// Compute L as if the range selected by choice had been flipped, updating
+// ext if apply is true. A net whose first terminal is left of the range keeps
+// it. Otherwise its first terminal must be in the range, and findSpans() has
+// already found it. The same goes for the last terminal.
+int Placement::lengthAfter(vec4i choice, bool apply) {
+	findSpans(choice);
+
+	int first = 2*choice[2];
+	int last = 2*choice[3]+2;
+	vec2i empty(((int)stack[0].size()+1)*2, -1);
+	int result = L;
+	for (auto n = touched.begin(); n != touched.end(); n++) {
+		vec2i e = ext[*n];
+		vec2i sp = span[*n];
+		int from = e[0] < first ? e[0] : sp[0];
+		int to = e[1] > last ? e[1] : sp[1];
+		result += (to - from) - (e[1] - e[0]);
+		if (apply) {
+			ext[*n] = vec2i(from, to);
+		}
+		span[*n] = empty;
+	}
+	touched.clear();
+	return result;
+}
+
+// Compute G as if the range selected by choice had been flipped. Each step of
+// the walk only looks at the devices and breaks at its own indices and the
+// ones just after, so we can pick up the cached walk from the last step
+// before the range and stop as soon as the walk lines back up with a cached
+// step after it.
+int Placement::gatesAfter(vec4i choice) const {
+	int lo = choice[2], hi = choice[3];
+	int size0 = (int)stack[0].size();
+	int size1 = (int)stack[1].size();
+
+	int i = 0, j = 0, result = 0;
+	for (int t = min(lo-1, size0-1); t >= 0; t--) {
+		if (align[t] >= 0 and align[t] < lo) {
+			i = t;
+			j = align[t];
+			result = G - tail[t];
+			break;
+		}
+	}
+
+	// Walk through the range, where the breaks and devices are mirrored
+	bool flip0 = (choice[0] <= 0 and choice[1] > 0);
+	bool flip1 = (choice[0] <= 1 and choice[1] > 1);
+	while (i < size0 and j < size1 and (i <= hi+1 or j <= hi+1)) {
+		bool ibrk = breakAfter(choice, 0, i);
+		bool jbrk = breakAfter(choice, 1, j);
+		if (ibrk and not jbrk) {
+			j++;
+		} else if (jbrk and not ibrk) {
+			i++;
+		}
+
+		if (i == size0 or j == size1) {
+			return result;
+		}
+
+		int n = stack[0][flip0 and i >= lo and i <= hi ? lo+hi-i : i].device;
+		int p = stack[1][flip1 and j >= lo and j <= hi ? lo+hi-j : j].device;
+		result += (n >= 0 and p >= 0 and pins[n*3] != pins[p*3]);
+		i++;
+		j++;
+	}
+
+	// Past the range, the rest of the walk is cached once it lines back up
+	while (i < size0 and j < size1) {
+		if (align[i] == j) {
+			return result + tail[i];
+		}
+
+		// This is the same as the walk above, but written without branches
+		// because the breaks are hard to predict.
+		int ibrk = breaks[0][i];
+		int jbrk = breaks[1][j];
+		j += ibrk & (1-jbrk);
+		i += jbrk & (1-ibrk);
+
+		if (i == size0 or j == size1) {
+			return result;
+		}
+
+		int n = stack[0][i].device;
+		int p = stack[1][j].device;
+		result += (n >= 0) & (p >= 0) & (pins[max(n, 0)*3] != pins[max(p, 0)*3]);
+		i++;
+		j++;
+	}
+	return result;
 }
 
 void Placement::move(vec4i choice) {
+	L = lengthAfter(choice, true);
+
 	for (int i = choice[0]; i < choice[1]; i++) {
 		int j = choice[2], k = choice[3];
 		for (; j < k; j++, k--) {
@@ -69,68 +524,336 @@ void Placement::move(vec4i choice) {
 		if (j == k) {
 			stack[i][j].flip = not stack[i][j].flip;
 		}
+
+		for (j = max(choice[2], 1); j <= choice[3]+1 and j < (int)stack[i].size(); j++) {
+			bool curr = hasBreak(pins, stack[i][j-1], stack[i][j]);
+			brk[i] += (int)curr - (int)breaks[i][j];
+			breaks[i][j] = curr;
+		}
 	}
+
+	updateAlignment();
 }
 
-// Compute the cost of this placement using the cost function documented in floret/floret/Placer.h
+// Compute the cost of this placement using the cost function documented in
+// Placer.h from the cached terms
 int Placement::score() {
-	int B = 0, W = 0, L = 0, G = 0;
-	array<int, 2> brk = {0,0};
+	int B = brk[0]+brk[1];
+	int W = min(brk[0]+d[0]-Wmin,brk[1]+d[1]-Wmin);
+	return max(0, b*B*B + l*L + w*W*W + g*G);
+}
+
+int Placement::score(vec4i choice) {
+	array<int, 2> nbrk = brk;
+	for (int type = choice[0]; type < choice[1]; type++) {
+		int edges[2] = {choice[2], choice[3]+1};
+		for (int k = 0; k < 2; k++) {
+			if (edges[k] < (int)stack[type].size()) {
+				nbrk[type] += (int)breakAfter(choice, type, edges[k]) - (int)breaks[type][edges[k]];
+			}
+		}
+	}
+
+	int B = nbrk[0]+nbrk[1];
+	int W = min(nbrk[0]+d[0]-Wmin,nbrk[1]+d[1]-Wmin);
+	int nL = lengthAfter(choice, false);
+	int nG = gatesAfter(choice);
+	return max(0, b*B*B + l*nL + w*W*W + g*nG);
+}
+
+// Run simulated annealing from curr to find the closest minimum and return
+// its score. order is the list of all possible moves, which is reshuffled
+// every iteration.
+static int anneal(Placement &curr, vector<vec4i> &order, float step, float rate, std::default_random_engine &rand) {
+	int score = 0;
+	int newScore = curr.score();
+	float currStep = step;
+	do {
+		// Test all of the possible moves and pick the best one.
+		score = newScore;
+		for (auto choice = order.begin(); choice != order.end(); choice++) {
+			// Check if this move makes any improvement within the constraints of
+			// the annealing temperature
+			newScore = curr.score(*choice);
+			if (newScore < score*currStep) {
+				curr.move(*choice);
+				break;
+			}
+		}
+
+		// Reshuffle the list of possible moves
+		shuffle(order.begin(), order.end(), rand);
+
+		// cool the annealing temperature
+		float prevStep = currStep;
+		currStep -= (currStep - 1.0)*rate;
+		if (currStep == prevStep) {
+			currStep = 1.0;
+		}
+	} while ((float)score*currStep - (float)newScore > 0.01);
+	return score;
+}
+
+// The state of the branch and bound search in Placement::exact(). Both stacks
+// are filled in from left to right one index at a time, and everything here
+// describes the prefix that has been placed so far.
+struct ExactSearch {
+	ExactSearch(const Placement &start, int budget);
+	~ExactSearch();
+
+	Placement curr;
+	int size;
+
+	// The number of nodes that search() may still visit, or -1 for no limit.
+	// complete is cleared if the search ran out before it was done.
+	int budget;
+	bool complete;
+
+	array<vector<Device>, 2> best;
+	int bestScore;
+
+	// minBreaks() less the dummy transistors in each stack. A dummy transistor
+	// can take the place of a break, so this is a lower bound on the breaks in
+	// any complete placement.
+	array<int, 2> floor;
+	array<int, 2> dummies;
+	vector<char> used;
+
+	// These mirror Placement::breaks, Placement::brk, and Placement::ext for
+	// the prefix. remain[n] is the number of terminals of net n that haven't
+	// been placed, and unused is the part of L contributed by nets that have
+	// no terminals at all, see Placement::update(). history holds the values
+	// of ext that place() overwrote so that unplace() can put them back.
+	array<vector<char>, 2> breaks;
+	array<int, 2> brk;
+	vector<vec2i> ext;
+	vector<vec2i> history;
+	vector<int> remain;
+	int unused;
+
+	void options(int type, int len, vector<Device> &result) const;
+	void place(int type, int i, Device dev);
+	void unplace(int type, int i);
+	int bound(int len) const;
+	void search(int len);
+};
+
+ExactSearch::ExactSearch(const Placement &start, int budget) : curr(start) {
+	const Subckt &ckt = curr.ckt;
+	size = (int)curr.stack[0].size();
+	this->budget = budget;
+	complete = true;
+	best = curr.stack;
+	bestScore = curr.score();
+
+	array<int, 2> count = {0, 0};
+	for (auto m = ckt.mos.begin(); m != ckt.mos.end(); m++) {
+		count[m->type]++;
+	}
+
+	remain.assign(ckt.nets.size(), 0);
+	for (auto p = curr.pins.begin(); p != curr.pins.end(); p++) {
+		remain[*p]++;
+	}
+
+	unused = 0;
+	for (auto r = remain.begin(); r != remain.end(); r++) {
+		unused += (*r == 0 ? -1 - 2*(size+1) : 0);
+	}
 
-	// compute intermediate values
-	// brk[] counts the number of diffusion breaks in this placement for each stack
-	// ext[] finds the first and last index of each net
-	vector<vec2i> ext(ckt.nets.size(), vec2i(((int)stack[0].size()+1)*2, -1));
 	for (int type = 0; type < 2; type++) {
-		for (auto c = stack[type].begin(); c != stack[type].end(); c++) {
-			brk[type] += (c+1 != stack[type].end() and c->device >= 0 and (c+1)->device >= 0 and ckt.mos[c->device].right(c->flip) != ckt.mos[(c+1)->device].left((c+1)->flip));
+		dummies[type] = size - count[type];
+		floor[type] = minBreaks(ckt, type) - dummies[type];
+		breaks[type].assign(size, false);
+		brk[type] = 0;
+	}
+	used.assign(ckt.mos.size(), false);
+	ext.assign(ckt.nets.size(), vec2i((size+1)*2, -1));
+}
+
+ExactSearch::~ExactSearch() {
+}
 
-			if (c->device >= 0) {
-				int gate = ckt.mos[c->device].gate;
-				int source = ckt.mos[c->device].source;
-				int drain = ckt.mos[c->device].drain;
-				int off = (c-stack[type].begin())<<1;
+// List the devices that could go at index len of the stack, the ones that
+// don't add a break first. Devices with the same nets on the same sides are
+// interchangeable, so only one of them is listed, and so is only one dummy.
+void ExactSearch::options(int type, int len, vector<Device> &result) const {
+	const vector<int> &pins = curr.pins;
+	result.clear();
+	if (dummies[type] > 0) {
+		result.push_back(Device{-1, false});
+	}
 
-				ext[gate][0] = min(ext[gate][0], off+1);
-				ext[gate][1] = max(ext[gate][1], off+1);
-				ext[source][0] = min(ext[source][0], off+2*((int)(not c->flip)));
-				ext[source][1] = max(ext[source][1], off+2*((int)(not c->flip)));
-				ext[drain][0] = min(ext[drain][0], off+2*((int)c->flip));
-				ext[drain][1] = max(ext[drain][1], off+2*((int)c->flip));
+	int cont = (int)result.size();
+	for (int i = 0; i < (int)curr.ckt.mos.size(); i++) {
+		if (used[i] or curr.ckt.mos[i].type != type) {
+			continue;
+		}
+
+		for (int f = 0; f < 2; f++) {
+			Device dev{i, f == 1};
+			if (f == 1 and pins[i*3+1] == pins[i*3+2]) {
+				continue;
+			}
+
+			bool found = false;
+			for (auto o = result.begin(); o != result.end() and not found; o++) {
+				found = (o->device >= 0
+					and pins[o->device*3] == pins[i*3]
+					and leftOf(pins, *o) == leftOf(pins, dev)
+					and rightOf(pins, *o) == rightOf(pins, dev));
+			}
+			if (found) {
+				continue;
+			}
+
+			result.push_back(dev);
+			if (len == 0 or not hasBreak(pins, curr.stack[type][len-1], dev)) {
+				rotate(result.begin()+cont, result.end()-1, result.end());
+				cont++;
 			}
 		}
 	}
+}
+
+void ExactSearch::place(int type, int i, Device dev) {
+	curr.stack[type][i] = dev;
+	breaks[type][i] = (i > 0 and hasBreak(curr.pins, curr.stack[type][i-1], dev));
+	brk[type] += breaks[type][i];
+	if (dev.device < 0) {
+		dummies[type]--;
+		return;
+	}
 
-	// compute B, L, and W
-	for (int i = 0; i < (int)ext.size(); i++) {
-		L += ext[i][1] - ext[i][0];
+	used[dev.device] = true;
+	const int *p = curr.pins.data() + dev.device*3;
+	int off = i<<1;
+	int pos[3] = {off+1, off+2*((int)(not dev.flip)), off+2*((int)dev.flip)};
+	for (int k = 0; k < 3; k++) {
+		history.push_back(ext[p[k]]);
+		ext[p[k]][0] = min(ext[p[k]][0], pos[k]);
+		ext[p[k]][1] = max(ext[p[k]][1], pos[k]);
+		remain[p[k]]--;
 	}
-	B = brk[0]+brk[1];
-	W = min(brk[0]+d[0]-Wmin,brk[1]+d[1]-Wmin);
+}
 
-	// compute G, keeping track of diffusion breaks
-	for (auto i = stack[0].begin(), j = stack[1].begin(); i != stack[0].end() and j != stack[1].end(); i++, j++) {
-		bool ibrk = (i != stack[0].begin() and (i-1)->device >= 0 and i->device >= 0 and ckt.mos[(i-1)->device].right((i-1)->flip) != ckt.mos[i->device].left(i->flip));
-		bool jbrk = (j != stack[1].begin() and (j-1)->device >= 0 and j->device >= 0 and ckt.mos[(j-1)->device].right((j-1)->flip) != ckt.mos[j->device].left(j->flip));
+void ExactSearch::unplace(int type, int i) {
+	Device dev = curr.stack[type][i];
+	brk[type] -= breaks[type][i];
+	breaks[type][i] = false;
+	if (dev.device < 0) {
+		dummies[type]++;
+		return;
+	}
 
-		if (ibrk and not jbrk) {
+	used[dev.device] = false;
+	const int *p = curr.pins.data() + dev.device*3;
+	for (int k = 2; k >= 0; k--) {
+		remain[p[k]]++;
+		ext[p[k]] = history.back();
+		history.pop_back();
+	}
+}
+
+// Find a lower bound on the score of any placement that starts with the
+// first len indices of both stacks.
+int ExactSearch::bound(int len) const {
+	array<int, 2> lb;
+	for (int type = 0; type < 2; type++) {
+		lb[type] = max(brk[type], floor[type]);
+	}
+	int B = lb[0]+lb[1];
+	// W only grows with the breaks, but it is squared, so a negative W can
+	// only be bounded below by zero.
+	int W = max(0, min(lb[0]+curr.d[0]-curr.Wmin, lb[1]+curr.d[1]-curr.Wmin));
+
+	// The terminals that are left all go at or after position 2*len
+	int L = unused;
+	for (int n = 0; n < (int)ext.size(); n++) {
+		if (ext[n][1] >= 0) {
+			L += max(ext[n][1], remain[n] > 0 ? 2*len : 0) - ext[n][0];
+		}
+	}
+
+	// This is Placement::updateAlignment() cut short at the end of the prefix
+	int G = 0;
+	int i = 0, j = 0;
+	while (i < len and j < len) {
+		if (breaks[0][i] and not breaks[1][j]) {
 			j++;
-		} else if (jbrk and not ibrk) {
+		} else if (breaks[1][j] and not breaks[0][i]) {
 			i++;
 		}
-		
-		if (i == stack[0].end() or j == stack[1].end()) {
+
+		if (i == len or j == len) {
 			break;
 		}
 
-		G += (i->device >= 0 and j->device >= 0 and ckt.mos[i->device].gate != ckt.mos[j->device].gate);
+		int n = curr.stack[0][i].device;
+		int p = curr.stack[1][j].device;
+		G += (n >= 0 and p >= 0 and curr.pins[n*3] != curr.pins[p*3]);
+		i++;
+		j++;
 	}
 
-	return max(0, b*B*B + l*L + w*W*W + g*G);
+	return max(0, curr.b*B*B + curr.l*L + curr.w*W*W + curr.g*G);
+}
+
+void ExactSearch::search(int len) {
+	if (budget == 0) {
+		complete = false;
+		return;
+	} else if (budget > 0) {
+		budget--;
+	}
+
+	if (len == size) {
+		curr.update();
+		int score = curr.score();
+		if (score < bestScore) {
+			bestScore = score;
+			best = curr.stack;
+		}
+		return;
+	}
+
+	array<vector<Device>, 2> opts;
+	options(0, len, opts[0]);
+	for (auto n = opts[0].begin(); n != opts[0].end(); n++) {
+		place(0, len, *n);
+		options(1, len, opts[1]);
+		for (auto p = opts[1].begin(); p != opts[1].end(); p++) {
+			place(1, len, *p);
+			if (bound(len+1) < bestScore) {
+				search(len+1);
+			}
+			unplace(1, len);
+		}
+		unplace(0, len);
+	}
+}
+
+// The search is kept serial, with a fixed order of options, so that the
+// placement that it returns among several with the same score doesn't depend
+// upon timing. For the cells that it's meant for, a good starting bound from
+// solve() matters far more than threads would.
+Placement Placement::exact(const Placement &start, int budget, bool *complete) {
+	ExactSearch search(start, budget);
+	if (search.size > 0) {
+		search.search(0);
+	}
+	if (complete != nullptr) {
+		*complete = search.complete;
+	}
+
+	Placement result(start);
+	result.stack = search.best;
+	result.update();
+	return result;
 }
 
-Placement Placement::solve(const Subckt &ckt, int starts, int b, int l, int w, int g, float step, float rate) {
-	std::default_random_engine rand(0/*std::random_device{}()*/);
+Placement Placement::solve(const Subckt &ckt, int starts, int b, int l, int w, int g, float step, float rate, int threads, unsigned seed, int exactSize, int exactBudget) {
+	std::default_random_engine rand(seed);
 	if (ckt.mos.size() == 0) {
 		return Placement(ckt, b, l, w, g, rand);
 	}
@@ -145,7 +868,8 @@ Placement Placement::solve(const Subckt &ckt, int starts, int b, int l, int w, i
 	Placement best(ckt, b, l, w, g, rand);
 	int bestScore = best.score();
 
-	// Precache the list of all possible moves. These will get reshuffled each time.
+	// Precache the list of all possible moves. Each start reshuffles its own
+	// copy.
 	vector<vec4i> choices;
 	for (int i = 0; i < 3; i++) {
 		int end = (i == 2 ? min((int)best.stack[0].size(), (int)best.stack[1].size()) : (int)best.stack[i].size());
@@ -156,52 +880,77 @@ Placement Placement::solve(const Subckt &ckt, int starts, int b, int l, int w, i
 		}
 	}
 
-	// Check multiple possible initial placements to avoid local minima
-	for (int i = 0; i < starts; i++) {
-		//printf("start %d/%d\r", i, starts);
-		//fflush(stdout);
+	// Most static CMOS cells are series-parallel, and for those the descent
+	// from an Euler trail often has the fewest breaks, lines up every gate,
+	// and packs every net as tightly as it can be. minBreaks() and minLength()
+	// are lower bounds on the breaks and L even if the diffusion graph isn't
+	// connected, so meeting them means that no restart could do better. G is
+	// trivially zero when one of the stacks is empty, so that isn't enough on
+	// its own.
+	Placement first(best);
+	first.euler(rand);
+	vector<vec4i> order = choices;
+	if (anneal(first, order, 1.0, rate, rand) < bestScore) {
+		best = first;
+		bestScore = best.score();
+	}
+	if (first.G == 0 and first.brk[0] <= max(0, minBreaks(ckt, 0)) and first.brk[1] <= max(0, minBreaks(ckt, 1))
+		and first.L <= minLength(ckt, (int)first.stack[0].size())) {
+		return best;
+	}
+
+	// Small cells are handed to exact() instead of the restarts, starting from
+	// that descent. Its running time depends a lot on how the cell is shaped
+	// though, so it's cut off after exactBudget nodes. What it found by then
+	// is kept as the score to beat and the restarts are run as usual.
+	if ((int)ckt.mos.size() <= exactSize) {
+		bool complete = false;
+		best = exact(best, exactBudget, &complete);
+		bestScore = best.score();
+		if (complete) {
+			return best;
+		}
+	}
 
-		// Run simulated annealing to find closest minimum
+	// Every start gets its own random engine seeded from its index, so the
+	// result of a start doesn't depend upon which thread ran it or what ran
+	// before it. The results are then reduced in start order below, which makes
+	// the final placement identical to a serial run no matter how many threads
+	// are used.
+	vector<int> scores(starts, 0);
+	vector<array<vector<Device>, 2> > stacks(starts);
+
+	// Check multiple possible initial placements to avoid local minima. Half
+	// of them start from Euler trails, which tend to land close to the
+	// optimum, and the other half stay random to keep the search from getting
+	// stuck near one of the trails.
+	parallelFor(starts, threads, [&](int i) {
+		std::default_random_engine rand(seed+1+(unsigned)i);
+		vector<vec4i> order = choices;
+
+		// Annealing from an Euler placement at full temperature just throws away
+		// the head start, so those only run the final descent.
 		Placement curr(ckt, b, l, w, g, rand);
-		int score = 0;
-		int newScore = curr.score();
 		float currStep = step;
-		do {
-			// Test all of the possible moves and pick the best one.
-			score = newScore;
-			for (auto choice = choices.begin(); choice != choices.end(); choice++) {
-				//printf("\r%06d/%06d  %f %f %06d<%06d", (int)(choice-choices.begin()), (int)choices.size(), currStep, rate, newScore, score);
-				//fflush(stdout);
-				curr.move(*choice);
-
-				// Check if this move makes any improvement within the constraints of
-				// the annealing temperature
-				newScore = curr.score();
-				if (newScore < score*currStep) {
-					break;
-				} else {
-					// undo the previous move
-					curr.move(*choice);
-				}
-			}
-
-			// Reshuffle the list of possible moves
-			shuffle(choices.begin(), choices.end(), rand);
-
-			// cool the annealing temperature
-			float prevStep = currStep;
-			currStep -= (currStep - 1.0)*rate;
-			if (currStep == prevStep) {
-				currStep = 1.0;
-			}
-			//printf("%f %f %d<%d\n", currStep, rate, newScore, score);
-		} while ((float)score*currStep - (float)newScore > 0.01);
+		if (i%2 == 0) {
+			curr.euler(rand);
+			currStep = 1.0;
+		}
+		scores[i] = anneal(curr, order, currStep, rate, rand);
+		stacks[i] = curr.stack;
+	});
 
-		if (score < bestScore) {
-			bestScore = score;
-			best = curr;
+	int found = -1;
+	for (int i = 0; i < starts; i++) {
+		if (scores[i] < bestScore) {
+			bestScore = scores[i];
+			found = i;
 		}
 	}
+	if (found >= 0) {
+		best.stack = stacks[found];
+		best.update();
+	}
 	//printf("Placement complete after %d iterations\n", starts);
 
 	return best;
@@ -215,6 +964,15 @@ Placement &Placement::operator=(const Placement &p) {
 	this->Wmin = p.Wmin;
 	this->d = p.d;
 	this->stack = p.stack;
+	this->pins = p.pins;
+	this->breaks = p.breaks;
+	this->brk = p.brk;
+	this->ext = p.ext;
+	this->L = p.L;
+	this->align = p.align;
+	this->tail = p.tail;
+	this->G = p.G;
+	this->span = p.span;
 	return *this;
 }
 
@@ -93,9 +93,87 @@ struct Placement {
 	// index into the placement.
 	array<vector<Device>, 2> stack;
 
+	// The following cache the terms of the cost function so that the cost of
+	// flipping a range can be found by looking mostly at the devices in and
+	// around that range. move() keeps them up to date. Call update() after
+	// modifying stack directly.
+
+	// The gate, source, and drain of each device in Subckt::mos, packed
+	// together so that we don't have to walk the full Mos records.
+	vector<int> pins;
+
+	// breaks[type][i] is true if there is a diffusion break between
+	// stack[type][i-1] and stack[type][i]. brk[type] is the total for each
+	// stack.
+	array<vector<char>, 2> breaks;
+	array<int, 2> brk;
+
+	// Device i in the stack has terminals at positions 2i, 2i+1, and 2i+2.
+	// ext[n] is the first and last position of net n, and L is the sum of
+	// their differences.
+	vector<vec2i> ext;
+	int L;
+
+	// G is computed by walking both stacks at once, skipping a device in one
+	// stack to line up diffusion breaks. align[i] is
+	// the pmos index at the step that starts at nmos index i, or -1 if no step
+	// starts there. tail[i] is the number of misaligned gates counted from that
+	// step to the end of the walk, so G is tail[0].
+	vector<int> align;
+	vector<int> tail;
+	int G;
+
+	// Scratch space for score(choice). span is indexed by net and reset after
+	// every use.
+	vector<vec2i> span;
+	vector<int> touched;
+
+	// Replace the stacks with a pair of Euler trails walked in lockstep, one
+	// over the nmos diffusion graph and one over the pmos diffusion graph (see
+	// Wmin above). At each step, this prefers a pair of devices that share a
+	// gate so that the gates line up, and it only starts a new trail (adding a
+	// diffusion break) once the current one has run out. Ties are broken with
+	// rand so that different starts get different trails.
+	void euler(std::default_random_engine &rand);
+
+	void update();
+	void updateAlignment();
+	bool breakAfter(vec4i choice, int type, int i) const;
+	void findSpans(vec4i choice);
+	int lengthAfter(vec4i choice, bool apply);
+	int gatesAfter(vec4i choice) const;
+
+	// Flip the selected range, choice is (first stack, last stack + 1, first
+	// device, last device).
 	void move(vec4i choice);	
 	int score();
-	static Placement solve(const Subckt &ckt, int starts=100, int b=12, int l=1, int w=1, int g=10, float step=2.0, float rate=0.02);
+	// Compute the score this placement would have after move(choice) without
+	// modifying it
+	int score(vec4i choice);
+
+	// Run simulated annealing from a number of starting placements and return
+	// the best result. Even starts begin from euler() and skip straight to the
+	// final descent, odd starts begin from a random placement. The starts are
+	// spread across threads (see threadCount()), and start i draws from its own
+	// random engine seeded with seed+1+i so the result doesn't depend upon the
+	// number of threads. If the descent from the first Euler placement already
+	// has the fewest possible breaks, all of its gates line up, and L is as
+	// small as it can be, then the restarts are skipped.
+	//
+	// Cells with at most exactSize transistors are handed to exact() instead,
+	// starting from the descent of the first Euler placement. If it doesn't
+	// finish within exactBudget nodes, the restarts are run anyway.
+	static Placement solve(const Subckt &ckt, int starts=100, int b=12, int l=1, int w=1, int g=10, float step=2.0, float rate=0.02, int threads=1, unsigned seed=0, int exactSize=10, int exactBudget=100000);
+
+	// Search every ordering and orientation of the devices with branch and
+	// bound and return a placement with the lowest possible score. The stacks
+	// are kept at the size they have in start, and start's score is used as
+	// the initial upper bound, so start is returned if nothing beats it. This
+	// is exponential in the number of devices, so it should only be used for
+	// small cells. If budget isn't negative, the search gives up after visiting
+	// that many nodes and returns the best placement it found so far. complete
+	// is then set to false.
+	static Placement exact(const Placement &start, int budget=-1, bool *complete=nullptr);
 
 	Placement &operator=(const Placement &p);
 };
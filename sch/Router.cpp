@@ -5,9 +5,62 @@
 
 #include "Router.h"
 #include "Draw.h"
+#include "Cache.h"
 
 namespace sch {
 
+pair<OffsetMap::iterator, bool> OffsetMap::insert(pair<Index, int> value) {
+	auto pos = lower_bound(entries.begin(), entries.end(), value, [](const pair<Index, int> &e, const pair<Index, int> &v) {
+		return e.first < v.first;
+	});
+	if (pos != entries.end() and pos->first == value.first) {
+		return pair<iterator, bool>(pos, false);
+	}
+	return pair<iterator, bool>(entries.insert(pos, value), true);
+}
+
+OffsetMap::iterator OffsetMap::find(Index pin) {
+	auto pos = lower_bound(entries.begin(), entries.end(), pin, [](const pair<Index, int> &e, const Index &p) {
+		return e.first < p;
+	});
+	return (pos != entries.end() and pos->first == pin) ? pos : entries.end();
+}
+
+OffsetMap::const_iterator OffsetMap::find(Index pin) const {
+	auto pos = lower_bound(entries.begin(), entries.end(), pin, [](const pair<Index, int> &e, const Index &p) {
+		return e.first < p;
+	});
+	return (pos != entries.end() and pos->first == pin) ? pos : entries.end();
+}
+
+OffsetMap::iterator OffsetMap::begin() {
+	return entries.begin();
+}
+
+OffsetMap::iterator OffsetMap::end() {
+	return entries.end();
+}
+
+OffsetMap::const_iterator OffsetMap::begin() const {
+	return entries.begin();
+}
+
+OffsetMap::const_iterator OffsetMap::end() const {
+	return entries.end();
+}
+
+int OffsetMap::size() const {
+	return (int)entries.size();
+}
+
+bool OffsetMap::empty() const {
+	return entries.empty();
+}
+
+void OffsetMap::clear() {
+	entries.clear();
+}
+
 Pin::Pin(const Tech &tech) : layout(tech) {
 	device = -1;
 	outNet = -1;
@@ -157,6 +210,7 @@ Wire::Wire(const Tech &tech) : layout(tech) {
 	right = -1;
 	offset[Model::PMOS] = 0;
 	offset[Model::NMOS] = 0;
+	dirty = true;
 }
 
 Wire::Wire(const Tech &tech, int net) : layout(tech) {
@@ -165,6 +219,7 @@ Wire::Wire(const Tech &tech, int net) : layout(tech) {
 	this->right = -1;
 	this->offset[Model::PMOS] = 0;
 	this->offset[Model::NMOS] = 0;
+	this->dirty = true;
 }
 
 Wire::~Wire() {
@@ -290,9 +345,33 @@ void Stack::push(const Tech &tech, const Subckt &ckt, int device, bool flip) {
 	}
 }
 
-Router::Router(const Tech &tech, const Placement &place, bool progress, bool debug) {
+bool Stack::isStart(int pin) const {
+	return (pin == 0 or pins[pin-1].isContact()) and pins[pin].isContact();
+}
+
+// The largest spacing rule between any two layers in the technology. Shapes
+// that are farther apart than this can't interact. This covers every paint
+// layer, not just the ones used for routing, so model and implant layers are
+// included.
+static int maxSpacing(const Tech &tech) {
+	int result = 0;
+	for (int d0 = 0; d0 < (int)tech.paint.size(); d0++) {
+		for (int d1 = 0; d1 < (int)tech.paint.size(); d1++) {
+			result = max(result, tech.getSpacing(d0, d1));
+		}
+	}
+	return result;
+}
+
+Router::Router(const Tech &tech, const Placement &place, bool progress, bool debug, SpacingCache *cache, unsigned seed) : rand(seed) {
 	this->tech = &tech;
 	this->ckt = &place.ckt;
+	this->spacing = maxSpacing(tech);
+	if (cache == nullptr) {
+		ownCache.reset(new SpacingCache(tech));
+		cache = ownCache.get();
+	}
+	this->cache = cache;
 	this->cycleCount = 0;
 	this->cellHeight = 0;
 	this->cost = 0;
@@ -368,20 +447,22 @@ int Router::pinHeight(Index p) const {
 	return result;
 }
 
-vector<bitset> Router::routeOrderMap(int type) {
-	vector<bitset> result;
-	result.resize(routes.size());
+// result.get(j, i) is true if route i must be placed before route j, either
+// directly or through a chain of other routes
+bitmatrix Router::routeOrderMap(int type) {
+	bitmatrix result((int)routes.size());
 	for (int i = 0; i < (int)routes.size(); i++) {
 		auto n = type == Model::PMOS ? next(i) : prev(i);
 		for (auto j = n.begin(); j != n.end(); j++) {
-			result[j->first].set(i, true);
-			result[j->first] |= result[i];
+			result.set(j->first, i, true);
 		}
 	}
+	result.closure();
 	return result;
 }
 
 void Router::delRoute(int route) {
+	unindexRoute(route);
 	for (int i = (int)routeConstraints.size()-1; i >= 0; i--) {
 		if (routeConstraints[i].wires[0] == route or routeConstraints[i].wires[1] == route) {
 			routeConstraints.erase(routeConstraints.begin()+i);
@@ -394,6 +475,18 @@ void Router::delRoute(int route) {
 			}
 		}
 	}
+	for (int i = (int)routeSpacing.size()-1; i >= 0; i--) {
+		if (routeSpacing[i].wires[0] == route or routeSpacing[i].wires[1] == route) {
+			routeSpacing.erase(routeSpacing.begin()+i);
+		} else {
+			if (routeSpacing[i].wires[0] > route) {
+				routeSpacing[i].wires[0]--;
+			}
+			if (routeSpacing[i].wires[1] > route) {
+				routeSpacing[i].wires[1]--;
+			}
+		}
+	}
 	for (int i = 0; i < (int)stack.size(); i++) {
 		if (stack[i].route > route) {
 			stack[i].route--;
@@ -403,50 +496,144 @@ void Router::delRoute(int route) {
 	}
 
 	routes.erase(routes.begin()+route);
+
+	for (int type = 0; type < (int)pinRoutes.size(); type++) {
+		for (auto p = pinRoutes[type].begin(); p != pinRoutes[type].end(); p++) {
+			for (auto r = p->begin(); r != p->end(); r++) {
+				if (*r > route) {
+					(*r)--;
+				}
+			}
+		}
+	}
+	indexRouteConstraints();
+}
+
+// The extent of a layout along axis when it is drawn at pos. If the layout is
+// empty, then the extent is inverted so that it never overlaps anything.
+static vec2i layoutExtent(const Layout &layout, int axis, int pos) {
+	vec2i result(numeric_limits<int>::max(), numeric_limits<int>::min());
+	for (auto layer = layout.layers.begin(); layer != layout.layers.end(); layer++) {
+		for (auto r = layer->geo.begin(); r != layer->geo.end(); r++) {
+			result[0] = min(result[0], min(r->ll[axis], r->ur[axis]) + pos);
+			result[1] = max(result[1], max(r->ll[axis], r->ur[axis]) + pos);
+		}
+	}
+	return result;
+}
+
+// Find every pair (a[i].second, b[j].second) whose extents come within pad of
+// each other. This sweeps both lists from low to high, pairing each extent
+// with the extents from the other list that haven't ended yet.
+static void findOverlaps(vector<pair<vec2i, int> > a, vector<pair<vec2i, int> > b, int pad, vector<pair<int, int> > &result) {
+	auto byLeft = [](const pair<vec2i, int> &e0, const pair<vec2i, int> &e1) {
+		return e0.first[0] < e1.first[0] or (e0.first[0] == e1.first[0] and e0.second < e1.second);
+	};
+	sort(a.begin(), a.end(), byLeft);
+	sort(b.begin(), b.end(), byLeft);
+
+	array<vector<pair<vec2i, int> >, 2> active;
+	auto i = a.begin();
+	auto j = b.begin();
+	while (i != a.end() or j != b.end()) {
+		int side = (j == b.end() or (i != a.end() and i->first[0] <= j->first[0])) ? 0 : 1;
+		const pair<vec2i, int> &curr = side == 0 ? *i : *j;
+		if (curr.first[0] <= curr.first[1]) {
+			vector<pair<vec2i, int> > &other = active[1-side];
+			for (int k = (int)other.size()-1; k >= 0; k--) {
+				if (other[k].first[1] + pad < curr.first[0]) {
+					other[k] = other.back();
+					other.pop_back();
+				} else if (side == 0) {
+					result.push_back(pair<int, int>(curr.second, other[k].second));
+				} else {
+					result.push_back(pair<int, int>(other[k].second, curr.second));
+				}
+			}
+			active[side].push_back(curr);
+		}
+
+		if (side == 0) {
+			i++;
+		} else {
+			j++;
+		}
+	}
 }
 
 // depends on:
 // updatePinPos() - this determines what the pin constraints are
 bool Router::buildPinConstraints(int level, bool reset) {
-	// TODO(edward.bingham) this could be more efficiently done as a 1d rectangle
-	// overlap problem
 	set<PinConstraint> old;
 	old.swap(pinConstraints);
+
+	// A pmos and nmos pin can only constrain each other if they are
+	// horizontally within a spacing rule of each other. So we only run the DRC
+	// check for those pairs, which we find by sweeping over the horizontal
+	// extent of each layout.
 	if (level == 0) {
 		// Compare pin layout (without contact) to pin layout
-		for (int p = 0; p < (int)this->stack[Model::PMOS].pins.size(); p++) {
-			for (int n = 0; n < (int)this->stack[Model::NMOS].pins.size(); n++) {
-				int off = 0;
-				Pin &pmos = this->stack[Model::PMOS].pins[p];
-				Pin &nmos = this->stack[Model::NMOS].pins[n];
-				if (pmos.outNet != nmos.outNet and
-					minOffset(&off, 1, pmos.layout, pmos.pos,
-														 nmos.layout, nmos.pos,
-										Layout::IGNORE, Layout::MERGENET)) {
-					pinConstraints.insert(PinConstraint(p, n));
-				}
+		array<vector<pair<vec2i, int> >, 2> extents;
+		for (int type = 0; type < 2; type++) {
+			for (int i = 0; i < (int)this->stack[type].pins.size(); i++) {
+				const Pin &pin = this->stack[type].pins[i];
+				extents[type].push_back(pair<vec2i, int>(layoutExtent(pin.layout, 0, pin.pos), i));
+			}
+		}
+
+		vector<pair<int, int> > pairs;
+		findOverlaps(extents[Model::PMOS], extents[Model::NMOS], spacing, pairs);
+		for (auto c = pairs.begin(); c != pairs.end(); c++) {
+			int p = c->first;
+			int n = c->second;
+			int off = 0;
+			Pin &pmos = this->stack[Model::PMOS].pins[p];
+			Pin &nmos = this->stack[Model::NMOS].pins[n];
+			if (pmos.outNet != nmos.outNet and
+				cache->minOffset(&off, 1, pmos.layout, pmos.pos,
+													 nmos.layout, nmos.pos,
+									Layout::IGNORE, Layout::MERGENET)) {
+				pinConstraints.insert(PinConstraint(p, n));
 			}
 		}
 	} else if (level == 1) {
 		// Compare pin layout (without contact) to contact layout
+		array<vector<const Contact*>, 2> contacts;
+		array<vector<pair<vec2i, int> >, 2> contactExtents;
+		array<vector<pair<vec2i, int> >, 2> pinExtents;
 		for (auto r0 = routes.begin(); r0 != routes.end(); r0++) {
 			for (auto ct = r0->pins.begin(); ct != r0->pins.end(); ct++) {
 				if (ct->idx.type == Model::NMOS or ct->idx.type == Model::PMOS) {
-					for (int i = 0; i < (int)this->stack[1-ct->idx.type].pins.size(); i++) {
-						int off = 0;
-						const Pin &pmos = ct->idx.type == Model::PMOS ? this->pin(ct->idx) : this->stack[1-ct->idx.type].pins[i];
-						const Pin &nmos = ct->idx.type == Model::NMOS ? this->pin(ct->idx) : this->stack[1-ct->idx.type].pins[i];
-						const Layout &playout = ct->idx.type == Model::PMOS ? ct->layout : pmos.layout;
-						const Layout &nlayout = ct->idx.type == Model::NMOS ? ct->layout : nmos.layout;
-						int p = ct->idx.type == Model::PMOS ? ct->idx.pin : i;
-						int n = ct->idx.type == Model::NMOS ? ct->idx.pin : i;
-						if (pmos.outNet != nmos.outNet and
-							minOffset(&off, 1, playout, pmos.pos,
-																 nlayout, nmos.pos,
-												Layout::IGNORE, Layout::MERGENET)) {
-							pinConstraints.insert(PinConstraint(p, n));
-						}
-					}
+					contactExtents[ct->idx.type].push_back(pair<vec2i, int>(layoutExtent(ct->layout, 0, this->pin(ct->idx).pos), (int)contacts[ct->idx.type].size()));
+					contacts[ct->idx.type].push_back(&*ct);
+				}
+			}
+		}
+		for (int type = 0; type < 2; type++) {
+			for (int i = 0; i < (int)this->stack[type].pins.size(); i++) {
+				const Pin &pin = this->stack[type].pins[i];
+				pinExtents[type].push_back(pair<vec2i, int>(layoutExtent(pin.layout, 0, pin.pos), i));
+			}
+		}
+
+		for (int type = 0; type < 2; type++) {
+			vector<pair<int, int> > pairs;
+			findOverlaps(contactExtents[type], pinExtents[1-type], spacing, pairs);
+			for (auto c = pairs.begin(); c != pairs.end(); c++) {
+				const Contact *ct = contacts[type][c->first];
+				int i = c->second;
+				int off = 0;
+				const Pin &pmos = ct->idx.type == Model::PMOS ? this->pin(ct->idx) : this->stack[1-ct->idx.type].pins[i];
+				const Pin &nmos = ct->idx.type == Model::NMOS ? this->pin(ct->idx) : this->stack[1-ct->idx.type].pins[i];
+				const Layout &playout = ct->idx.type == Model::PMOS ? ct->layout : pmos.layout;
+				const Layout &nlayout = ct->idx.type == Model::NMOS ? ct->layout : nmos.layout;
+				int p = ct->idx.type == Model::PMOS ? ct->idx.pin : i;
+				int n = ct->idx.type == Model::NMOS ? ct->idx.pin : i;
+				if (pmos.outNet != nmos.outNet and
+					cache->minOffset(&off, 1, playout, pmos.pos,
+														 nlayout, nmos.pos,
+										Layout::IGNORE, Layout::MERGENET)) {
+					pinConstraints.insert(PinConstraint(p, n));
 				}
 			}
 		}
@@ -464,7 +651,7 @@ bool Router::buildPinConstraints(int level, bool reset) {
 								const Pin &nmos = c0->idx.type == Model::NMOS ? this->pin(c0->idx) : this->pin(c1->idx);
 								int p = c0->idx.type == Model::PMOS ? c0->idx.pin : c1->idx.pin;
 								int n = c0->idx.type == Model::NMOS ? c0->idx.pin : c1->idx.pin;
-								if (minOffset(&off, 1, c0->layout, pmos.pos,
+								if (cache->minOffset(&off, 1, c0->layout, pmos.pos,
 								                       c1->layout, nmos.pos,
 								                 Layout::IGNORE, Layout::MERGENET)) {
 									pinConstraints.insert(PinConstraint(p, n));
@@ -482,6 +669,8 @@ bool Router::buildPinConstraints(int level, bool reset) {
 			pinConstraints.insert(*c);
 		}
 	}
+	indexPinConstraints();
+
 	if (pinConstraints.size() != old.size()) {
 		return true;
 	}
@@ -510,14 +699,14 @@ void Router::buildViaConstraints() {
 	
 			for (int j = i-1; j >= 0; j--) {
 				int off = 0;
-				if (minOffset(&off, 0, this->stack[type].pins[j].layout, 0, this->stack[type].pins[i].conLayout, this->stack[type].pins[j].height/2, Layout::IGNORE, Layout::MERGENET)) {
+				if (cache->minOffset(&off, 0, this->stack[type].pins[j].layout, 0, this->stack[type].pins[i].conLayout, this->stack[type].pins[j].height/2, Layout::IGNORE, Layout::MERGENET)) {
 					viaConstraints.back().side[0].push_back(ViaConstraint::Pin{Index(type, j), off});
 				}
 			}
 
 			for (int j = i+1; j < (int)this->stack[type].pins.size(); j++) {
 				int off = 0;
-				if (minOffset(&off, 0, this->stack[type].pins[i].conLayout, this->stack[type].pins[j].height/2, this->stack[type].pins[j].layout, 0, Layout::IGNORE, Layout::MERGENET)) {
+				if (cache->minOffset(&off, 0, this->stack[type].pins[i].conLayout, this->stack[type].pins[j].height/2, this->stack[type].pins[j].layout, 0, Layout::IGNORE, Layout::MERGENET)) {
 					viaConstraints.back().side[1].push_back(ViaConstraint::Pin{Index(type, j), off});
 				}
 			}
@@ -531,6 +720,10 @@ void Router::buildViaConstraints() {
 
 void Router::buildRoutes() {
 	routes.clear();
+	routeSpacing.clear();
+	for (int type = 0; type < (int)pinRoutes.size(); type++) {
+		pinRoutes[type].clear();
+	}
 
 	// Create initial routes
 	routes.reserve(ckt->nets.size()+2);
@@ -560,23 +753,27 @@ void Router::buildRoutes() {
 		}
 	}
 
+	indexRoutes();
+	indexRouteConstraints();
 	buildContacts();
 }
 
 map<int, int> Router::next(int i) {
 	map<int, int> result;
-	for (auto c = routeConstraints.begin(); c != routeConstraints.end(); c++) {
-		if (c->select >= 0 and c->wires[c->select] == i) {
-			result.insert(pair<int, int>(c->wires[1-c->select], c->off[c->select]));
+	for (auto k = routeArcs[i].begin(); k != routeArcs[i].end(); k++) {
+		const RouteConstraint &c = routeConstraints[*k];
+		if (c.select >= 0 and c.wires[c.select] == i) {
+			result.insert(pair<int, int>(c.wires[1-c.select], c.off[c.select]));
 		}
 	}
 
-	for (auto c = pinConstraints.begin(); c != pinConstraints.end(); c++) {
-		if (routes[i].hasPin(this, Index(Model::PMOS, c->from))) {
-			for (int j = 0; j < (int)routes.size(); j++) {
-				if (j != i and result.find(j) == result.end()
-					and routes[j].hasPin(this, Index(Model::NMOS, c->to))) {
-					result.insert(pair<int, int>(j, 0));
+	for (auto ct = routes[i].pins.begin(); ct != routes[i].pins.end(); ct++) {
+		if (ct->idx.type == Model::PMOS) {
+			for (auto to = pinsTo[ct->idx.pin].begin(); to != pinsTo[ct->idx.pin].end(); to++) {
+				for (auto j = pinRoutes[Model::NMOS][*to].begin(); j != pinRoutes[Model::NMOS][*to].end(); j++) {
+					if (*j != i) {
+						result.insert(pair<int, int>(*j, 0));
+					}
 				}
 			}
 		}
@@ -586,18 +783,20 @@ map<int, int> Router::next(int i) {
 
 map<int, int> Router::prev(int i) {
 	map<int, int> result;
-	for (auto c = routeConstraints.begin(); c != routeConstraints.end(); c++) {
-		if (c->select >= 0 and c->wires[1-c->select] == i) {
-			result.insert(pair<int, int>(c->wires[c->select], c->off[c->select]));
+	for (auto k = routeArcs[i].begin(); k != routeArcs[i].end(); k++) {
+		const RouteConstraint &c = routeConstraints[*k];
+		if (c.select >= 0 and c.wires[1-c.select] == i) {
+			result.insert(pair<int, int>(c.wires[c.select], c.off[c.select]));
 		}
 	}
 
-	for (auto c = pinConstraints.begin(); c != pinConstraints.end(); c++) {
-		if (routes[i].hasPin(this, Index(Model::NMOS, c->to))) {
-			for (int j = 0; j < (int)routes.size(); j++) {
-				if (j != i and result.find(j) == result.end()
-					and routes[j].hasPin(this, Index(Model::PMOS, c->from))) {
-					result.insert(pair<int, int>(j, 0));
+	for (auto ct = routes[i].pins.begin(); ct != routes[i].pins.end(); ct++) {
+		if (ct->idx.type == Model::NMOS) {
+			for (auto from = pinsFrom[ct->idx.pin].begin(); from != pinsFrom[ct->idx.pin].end(); from++) {
+				for (auto j = pinRoutes[Model::PMOS][*from].begin(); j != pinRoutes[Model::PMOS][*from].end(); j++) {
+					if (*j != i) {
+						result.insert(pair<int, int>(*j, 0));
+					}
 				}
 			}
 		}
@@ -606,86 +805,72 @@ map<int, int> Router::prev(int i) {
 }
 
 bool Router::hasPinConstraint(int from, int to) {
-	for (auto i = pinConstraints.begin(); i != pinConstraints.end(); i++) {
-		if (routes[from].hasPin(this, Index(Model::PMOS, i->from))
-			and routes[to].hasPin(this, Index(Model::NMOS, i->to))) {
-			return true;
+	for (auto ct = routes[from].pins.begin(); ct != routes[from].pins.end(); ct++) {
+		if (ct->idx.type == Model::PMOS) {
+			for (auto n = pinsTo[ct->idx.pin].begin(); n != pinsTo[ct->idx.pin].end(); n++) {
+				if (find(pinRoutes[Model::NMOS][*n].begin(), pinRoutes[Model::NMOS][*n].end(), to) != pinRoutes[Model::NMOS][*n].end()) {
+					return true;
+				}
+			}
 		}
 	}
 	return false;
 }
 
-bool Router::findCycle(int s, const vector<set<int> > &Ak, vector<pair<int, set<int> > > &cycles) {
-	vector<bool> blocked(Ak.size(), false);
-	vector<set<int> > B(Ak.size(), set<int>());
-
-	struct frame {
-		frame() {
-			searched = false;
-		}
-		frame(vector<int> path) {
-			this->path = path;
-			searched = false;
+// Record the contacts of this route in pinRoutes
+void Router::indexRoute(int route) {
+	routes[route].dirty = true;
+	for (auto ct = routes[route].pins.begin(); ct != routes[route].pins.end(); ct++) {
+		vector<vector<int> > &index = pinRoutes[ct->idx.type];
+		if ((int)index.size() <= ct->idx.pin) {
+			index.resize(max(ct->idx.pin+1, (int)stack[ct->idx.type].pins.size()));
 		}
-		~frame() {}
-
-		vector<int> path;
-		bool searched;
-	};
-
-	vector<frame> stack;
-	stack.push_back(frame(vector<int>(1, s)));
+		index[ct->idx.pin].push_back(route);
+	}
+}
 
-	bool found = false;
-	while (not stack.empty()) {
-		int v = stack.back().path.back();
-		if (stack.back().searched) {
-			if (found) {
-				// Unblock vertex v
-				vector<int> unblock(1, v);
-				while (not unblock.empty()) {
-					int u = unblock.back();
-					unblock.pop_back();
-					blocked[u] = false;
-					for (auto w = B[u].begin(); w != B[u].end(); w++) {
-						if (blocked[*w]) {
-							unblock.push_back(*w);
-						}
-					}
-					B[u].clear();
-				}
-			} else {
-				for (auto w = Ak[v].begin(); w != Ak[v].end(); w++) {
-					B[*w].insert(v);
-				}
-			}
-			stack.pop_back();
-		} else {
-			stack.back().searched = true;
-			vector<int> path = stack.back().path;
-
-			blocked[v] = true;
-			for (auto w = Ak[v].begin(); w != Ak[v].end(); w++) {
-				if (*w == s) {
-					// We found a cycle
-					for (auto c0 = path.begin(); c0 != path.end(); c0++) {
-						cycles[*c0].first++;
-						for (auto c1 = path.begin(); c1 != path.end(); c1++) {
-							if (*c1 != *c0) {
-								cycles[*c0].second.insert(*c1);
-							}
-						}
-					}
-					found = true;
-				} else if (not blocked[*w]) {
-					stack.push_back(frame(path));
-					stack.back().path.push_back(*w);
-				}
+// Remove the contacts of this route from pinRoutes. This must be called
+// before the contacts of a route are changed.
+void Router::unindexRoute(int route) {
+	for (auto ct = routes[route].pins.begin(); ct != routes[route].pins.end(); ct++) {
+		vector<vector<int> > &index = pinRoutes[ct->idx.type];
+		if (ct->idx.pin < (int)index.size()) {
+			auto pos = find(index[ct->idx.pin].begin(), index[ct->idx.pin].end(), route);
+			if (pos != index[ct->idx.pin].end()) {
+				index[ct->idx.pin].erase(pos);
 			}
 		}
 	}
+}
 
-	return found;
+void Router::indexRoutes() {
+	for (int type = 0; type < (int)pinRoutes.size(); type++) {
+		pinRoutes[type].clear();
+		pinRoutes[type].resize(stack[type].pins.size());
+	}
+	for (int i = 0; i < (int)routes.size(); i++) {
+		indexRoute(i);
+	}
+}
+
+void Router::indexPinConstraints() {
+	pinsTo.clear();
+	pinsTo.resize(stack[Model::PMOS].pins.size());
+	pinsFrom.clear();
+	pinsFrom.resize(stack[Model::NMOS].pins.size());
+	for (auto c = pinConstraints.begin(); c != pinConstraints.end(); c++) {
+		pinsTo[c->from].push_back(c->to);
+		pinsFrom[c->to].push_back(c->from);
+	}
+}
+
+void Router::indexRouteConstraints() {
+	routeArcs.clear();
+	routeArcs.resize(routes.size());
+	for (int i = 0; i < (int)routeConstraints.size(); i++) {
+		routeArcs[routeConstraints[i].wires[0]].push_back(i);
+		routeArcs[routeConstraints[i].wires[1]].push_back(i);
+	}
 }
 
 bool Router::findCycles(vector<pair<int, set<int> > > &cycles) {
@@ -695,49 +880,114 @@ bool Router::findCycles(vector<pair<int, set<int> > > &cycles) {
 	// exponential blow up, and we can ensure that we split those cycles by
 	// splitting on the node in the cycle that has the most pin constraints
 	// (maximising min(in.size(), out.size()))
-	vector<set<int> > Ak(routes.size(), set<int>());
-	for (int i = 0; i < (int)routes.size(); i++) {
-		for (auto c = routeConstraints.begin(); c != routeConstraints.end(); c++) {
-			if (c->select >= 0 and c->wires[c->select] == i) {
-				Ak[i].insert(c->wires[1-c->select]);
-			}
+	//
+	// Enumerating every elementary cycle can blow up exponentially on dense
+	// cells. Every cycle lies entirely within a strongly connected component of
+	// the constraint graph, so we find those instead (Tarjan's algorithm) and
+	// break them up one route at a time. This is linear in the number of
+	// routes plus constraints.
+	//
+	// For each route in a nontrivial component, cycles[i].second holds the
+	// other routes in the component and cycles[i].first estimates how many
+	// cycles the route breaks if split, min(in-degree, out-degree) counting
+	// only arcs within the component. This is the usual greedy heuristic for
+	// the feedback vertex set problem.
+	int n = (int)routes.size();
+	cycles.assign(n, pair<int, set<int> >(0, set<int>()));
+
+	vector<vector<int> > Ak(n, vector<int>());
+	for (int i = 0; i < n; i++) {
+		map<int, int> m = next(i);
+		Ak[i].reserve(m.size());
+		for (auto j = m.begin(); j != m.end(); j++) {
+			Ak[i].push_back(j->first);
+		}
+	}
+
+	vector<int> index(n, -1);
+	vector<int> low(n, 0);
+	vector<int> comp(n, -1);
+	vector<bool> onStack(n, false);
+	vector<int> visited;
+	// <vertex, next arc to follow>
+	vector<pair<int, int> > stack;
+	int count = 0;
+	int comps = 0;
+	for (int s = 0; s < n; s++) {
+		if (index[s] >= 0) {
+			continue;
 		}
 
-		for (auto c = pinConstraints.begin(); c != pinConstraints.end(); c++) {
-			if (routes[i].hasPin(this, Index(Model::PMOS, c->from))) {
-				for (int j = 0; j < (int)routes.size(); j++) {
-					if (j != i and Ak[i].find(j) == Ak[i].end()
-						and routes[j].hasPin(this, Index(Model::NMOS, c->to))) {
-						Ak[i].insert(j);
-					}
+		index[s] = low[s] = count++;
+		visited.push_back(s);
+		onStack[s] = true;
+		stack.push_back(pair<int, int>(s, 0));
+		while (not stack.empty()) {
+			int v = stack.back().first;
+			if (stack.back().second < (int)Ak[v].size()) {
+				int w = Ak[v][stack.back().second++];
+				if (index[w] < 0) {
+					index[w] = low[w] = count++;
+					visited.push_back(w);
+					onStack[w] = true;
+					stack.push_back(pair<int, int>(w, 0));
+				} else if (onStack[w]) {
+					low[v] = min(low[v], index[w]);
 				}
+				continue;
+			}
+
+			stack.pop_back();
+			if (not stack.empty()) {
+				int u = stack.back().first;
+				low[u] = min(low[u], low[v]);
+			}
+			if (low[v] == index[v]) {
+				int w = -1;
+				do {
+					w = visited.back();
+					visited.pop_back();
+					onStack[w] = false;
+					comp[w] = comps;
+				} while (w != v);
+				comps++;
 			}
 		}
 	}
 
-	bool found = false;
-	for (int s = 0; s < (int)Ak.size(); s++) {
-		if (not Ak[s].empty()) {
-			found = findCycle(s, Ak, cycles) or found;
-			Ak[s].clear();
+	vector<vector<int> > members(comps, vector<int>());
+	for (int i = 0; i < n; i++) {
+		members[comp[i]].push_back(i);
+	}
+
+	vector<int> numIn(n, 0);
+	vector<int> numOut(n, 0);
+	for (int i = 0; i < n; i++) {
+		for (auto j = Ak[i].begin(); j != Ak[i].end(); j++) {
+			if (comp[*j] == comp[i]) {
+				numOut[i]++;
+				numIn[*j]++;
+			}
 		}
 	}
 
-	/*printf("cycles: {");
-	for (auto c = cycles.begin(); c != cycles.end(); c++) {
-		if (c != cycles.begin()) {
-			printf("\n\t");
+	bool found = false;
+	for (auto c = members.begin(); c != members.end(); c++) {
+		if (c->size() < 2) {
+			continue;
 		}
-		printf("{");
-		for (auto v = c->begin(); v != c->end(); v++) {
-			if (v != c->begin()) {
-				printf(" ");
+
+		found = true;
+		for (auto i = c->begin(); i != c->end(); i++) {
+			cycles[*i].first = min(numIn[*i], numOut[*i]);
+			for (auto j = c->begin(); j != c->end(); j++) {
+				if (*j != *i) {
+					cycles[*i].second.insert(cycles[*i].second.end(), *j);
+				}
 			}
-			printf("%d", *v);
 		}
-		printf("}");
 	}
-	printf("}\n");*/
+
 	return found;
 }
 
@@ -761,6 +1011,8 @@ bool Router::breakRoute(int route, set<int> cycleRoutes) {
 	int right = max(this->stack[0].pins.back().pos, this->stack[1].pins.back().pos);
 	int center = (left + right)/2;
 
+	unindexRoute(route);
+
 	Wire wp(*tech, routes[route].net);
 	Wire wn(*tech, routes[route].net);
 	wp.offset = routes[route].offset;
@@ -837,6 +1089,7 @@ bool Router::breakRoute(int route, set<int> cycleRoutes) {
 	}
 
 	if (wp.pins.empty() or wn.pins.empty()) {
+		indexRoute(route);
 		return false;
 	}
 
@@ -1020,8 +1273,10 @@ bool Router::breakRoute(int route, set<int> cycleRoutes) {
 		}
 	}
 
-	routes[route] = wp;
-	routes.push_back(wn);
+	routes[route] = std::move(wp);
+	routes.push_back(std::move(wn));
+	indexRoute(route);
+	indexRoute((int)routes.size()-1);
 
 	// Update Route Constraints
 	if (not routeConstraints.empty()) {
@@ -1039,6 +1294,7 @@ bool Router::breakRoute(int route, set<int> cycleRoutes) {
 			}
 		}
 	}
+	indexRouteConstraints();
 
 	return true;
 }
@@ -1051,13 +1307,13 @@ bool Router::breakCycles() {
 		vector<int> numIn(routes.size(), 0);
 		vector<int> numOut(routes.size(), 0);
 		for (auto i = pinConstraints.begin(); i != pinConstraints.end(); i++) {
-			for (int j = 0; j < (int)routes.size(); j++) {
-				if (routes[j].hasPin(this, Index(Model::PMOS, i->from))) {
-					numOut[j]++;
-				}
-				if (routes[j].hasPin(this, Index(Model::NMOS, i->to))) {
-					numIn[j]++;
-				}
+			const vector<int> &from = pinRoutes[Model::PMOS][i->from];
+			for (auto j = from.begin(); j != from.end(); j++) {
+				numOut[*j]++;
+			}
+			const vector<int> &to = pinRoutes[Model::NMOS][i->to];
+			for (auto j = to.begin(); j != to.end(); j++) {
+				numIn[*j]++;
 			}
 		}
 
@@ -1102,7 +1358,7 @@ bool Router::breakCycles() {
 		map<pair<int, int>, vector<int> > order;
 		for (int i = 0; i < (int)cycles.size(); i++) {
 			int density = min(numIn[i], numOut[i]);
-			if (routes[i].net >= 0) {
+			if (routes[i].net >= 0 and not cycles[i].second.empty()) {
 				auto pos = order.insert(pair<pair<int, int>, vector<int> >(pair<int, int>(cycles[i].first, density), vector<int>())).first;
 				pos->second.push_back(i);
 			}
@@ -1126,11 +1382,6 @@ bool Router::breakCycles() {
 			return change;
 		}
 		change = true;
-
-		for (auto i = cycles.begin(); i != cycles.end(); i++) {
-			i->first = 0;
-			i->second.clear();
-		}
 	}
 	return change;
 }
@@ -1212,8 +1463,8 @@ struct Alignment {
 
 	int dist() const {
 		array<bool, 2> startOfStack = {
-			(pin[0] == 0 or rt->stack[0].pins[1-pin[0]].isContact()) and rt->stack[0].pins[pin[0]].isContact(),
-			(pin[1] == 0 or rt->stack[1].pins[1-pin[1]].isContact()) and rt->stack[1].pins[pin[1]].isContact()
+			rt->stack[0].isStart(pin[0]),
+			rt->stack[1].isStart(pin[1])
 		};
 
 		int result = rt->stack[1].pins[pin[1]].pos - rt->stack[0].pins[pin[0]].pos;
@@ -1266,8 +1517,8 @@ void Router::alignVirtualPins() {
 				}
 
 				array<int, 2> off;
-				bool fromto = minOffset(&off[0], 0, stack[2].pins[i].layout, 0, stack[type].pins[j].layout, 0, Layout::DEFAULT, Layout::DEFAULT);
-				bool tofrom = minOffset(&off[1], 0, stack[type].pins[j].layout, 0, stack[2].pins[i].layout, 0, Layout::DEFAULT, Layout::DEFAULT);
+				bool fromto = cache->minOffset(&off[0], 0, stack[2].pins[i].layout, 0, stack[type].pins[j].layout, 0, Layout::DEFAULT, Layout::DEFAULT);
+				bool tofrom = cache->minOffset(&off[1], 0, stack[type].pins[j].layout, 0, stack[2].pins[i].layout, 0, Layout::DEFAULT, Layout::DEFAULT);
 
 				// TODO(edward.bingham) lo and hi values don't include route or contact height
 				if ((fromto or tofrom) and stack[2].pins[i].lo < stack[type].pins[j].hi and stack[type].pins[j].lo < stack[2].pins[i].hi) {
@@ -1367,6 +1618,9 @@ void Router::buildPins() {
 			drawPin(pin.layout, *ckt, this->stack[type], i);
 		}
 	}
+	for (auto r = routes.begin(); r != routes.end(); r++) {
+		r->drawn.clear();
+	}
 
 	buildHorizConstraints();
 	updatePinPos();
@@ -1414,6 +1668,8 @@ bool Router::buildHorizConstraints(bool reset) {
 	// from that instead of checking spacing from whole pin. The pin might be
 	// quite a bit larger than the connective tissue between the vias across
 	// routes.
+	vector<Index> pins;
+	vector<pair<vec2i, int> > pinExtents;
 	for (int type = 0; type < 2; type++) {
 		for (int i = 0; i < (int)this->stack[type].pins.size(); i++) {
 			Pin &pin = this->stack[type].pins[i];
@@ -1422,37 +1678,63 @@ bool Router::buildHorizConstraints(bool reset) {
 			if (i+1 < (int)this->stack[type].pins.size()) {
 				Pin &next = this->stack[type].pins[i+1];
 				int substrateMode = (pin.isGate() or next.isGate()) ? Layout::MERGENET : Layout::DEFAULT;
-				if (minOffset(&off, 0, pin.layout, 0, next.layout, 0, substrateMode, Layout::DEFAULT, false)) {
+				if (cache->minOffset(&off, 0, pin.layout, 0, next.layout, 0, substrateMode, Layout::DEFAULT, false)) {
 					change = pin.offsetToPin(Index(type, i+1), off) or change;
 				} else if (debug) {
 					printf("error: no offset found at pin (%d,%d)\n", type, i+1);
 				}
 			}
 
-			for (int j = 0; j < (int)routes.size(); j++) {
-				// TODO(edward.bingham) might be preferable to set routingMode to
-				// Layout::MERGENET and to re-enable this skip condition, then add
-				// rectangles into the layout to fill in nets with minimum spacing
-				// violations.
-				int routingMode = Layout::MERGENET;
-				if (routes[j].net < 0 or routes[j].hasPin(this, Index(type, i))) {
-					continue;
-				}
+			pinExtents.push_back(pair<vec2i, int>(layoutExtent(pin.layout, 1, 0), (int)pins.size()));
+			pins.push_back(Index(type, i));
+		}
+	}
 
-				for (int k = 0; k < (int)routes[j].pins.size(); k++) {
-					int off = 0;
-					if ((routes[j].pins[k].idx.type != type or i < routes[j].pins[k].idx.pin) and
-					    minOffset(&off, 0, pin.layout, 0, routes[j].pins[k].layout, 0, Layout::IGNORE, routingMode)) {
-						change = routes[j].pins[k].offsetFromPin(Index(type, i), off) or change;
-					}
+	// The horizontal position of each pin and via is what we are solving for,
+	// so the only thing that rules out a pair ahead of time is its vertical
+	// extent. A via can only push against a pin if they come within a spacing
+	// rule of each other vertically.
+	vector<pair<int, int> > contacts;
+	vector<pair<vec2i, int> > contactExtents;
+	for (int j = 0; j < (int)routes.size(); j++) {
+		if (routes[j].net < 0) {
+			continue;
+		}
+		for (int k = 0; k < (int)routes[j].pins.size(); k++) {
+			contactExtents.push_back(pair<vec2i, int>(layoutExtent(routes[j].pins[k].layout, 1, 0), (int)contacts.size()));
+			contacts.push_back(pair<int, int>(j, k));
+		}
+	}
 
-					off = 0;
-					if ((routes[j].pins[k].idx.type != type or routes[j].pins[k].idx.pin < i) and
-					    minOffset(&off, 0, routes[j].pins[k].layout, 0, pin.layout, 0, Layout::IGNORE, routingMode)) {
-						change = routes[j].pins[k].offsetToPin(Index(type, i), off) or change;
-					}
-				}
-			}
+	vector<pair<int, int> > pairs;
+	findOverlaps(pinExtents, contactExtents, spacing, pairs);
+	for (auto c = pairs.begin(); c != pairs.end(); c++) {
+		int type = pins[c->first].type;
+		int i = pins[c->first].pin;
+		int j = contacts[c->second].first;
+		int k = contacts[c->second].second;
+		Pin &pin = this->stack[type].pins[i];
+		Contact &ct = routes[j].pins[k];
+
+		// TODO(edward.bingham) might be preferable to set routingMode to
+		// Layout::MERGENET and to re-enable this skip condition, then add
+		// rectangles into the layout to fill in nets with minimum spacing
+		// violations.
+		int routingMode = Layout::MERGENET;
+		if (routes[j].hasPin(this, Index(type, i))) {
+			continue;
+		}
+
+		int off = 0;
+		if ((ct.idx.type != type or i < ct.idx.pin) and
+		    cache->minOffset(&off, 0, pin.layout, 0, ct.layout, 0, Layout::IGNORE, routingMode)) {
+			change = ct.offsetFromPin(Index(type, i), off) or change;
+		}
+
+		off = 0;
+		if ((ct.idx.type != type or ct.idx.pin < i) and
+		    cache->minOffset(&off, 0, ct.layout, 0, pin.layout, 0, Layout::IGNORE, routingMode)) {
+			change = ct.offsetToPin(Index(type, i), off) or change;
 		}
 	}
 	return change;
@@ -1714,30 +1996,79 @@ bool Router::alignPins(int maxDist, bool reset) {
 	return change;
 }
 
+static bool sameGeometry(const Layout &l0, const Layout &l1) {
+	if (l0.layers.size() != l1.layers.size()) {
+		return false;
+	}
+	for (auto a = l0.layers.begin(), b = l1.layers.begin(); a != l0.layers.end(); a++, b++) {
+		if (a->draw != b->draw or a->geo.size() != b->geo.size()) {
+			return false;
+		}
+		for (auto r0 = a->geo.begin(), r1 = b->geo.begin(); r0 != a->geo.end(); r0++, r1++) {
+			if (r0->net != r1->net or not (r0->ll == r1->ll) or not (r0->ur == r1->ur)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// List everything that drawWire() or drawStack() reads to draw this route,
+// other than the technology and the pin layouts, which don't change after
+// buildPins().
+static void drawInputs(vector<int> &dst, const Router &rt, const Wire &wire) {
+	dst.clear();
+	dst.push_back(wire.net);
+	if (wire.net >= 0) {
+		for (auto c = wire.pins.begin(); c != wire.pins.end(); c++) {
+			const Pin &pin = rt.pin(c->idx);
+			dst.insert(dst.end(), {c->idx.type, c->idx.pin, c->left, c->right, pin.layer, pin.pos, pin.baseNet});
+		}
+		dst.insert(dst.end(), wire.level.begin(), wire.level.end());
+	} else {
+		const Stack &stack = rt.stack[flip(wire.net)];
+		for (auto pin = stack.pins.begin(); pin != stack.pins.end(); pin++) {
+			dst.insert(dst.end(), {pin->device, pin->pos, pin->height});
+		}
+	}
+}
+
 // depends on:
 // updatePinPos() - contacts on the route need an up-to-date
 //                  position before we draw them
 void Router::drawRoutes() {
+	// Draw the routes whose contacts or pins moved, marking the ones whose
+	// geometry changed
+	vector<int> inputs;
 	for (int i = 0; i < (int)routes.size(); i++) {
-		routes[i].layout.clear();
-	}
+		drawInputs(inputs, *this, routes[i]);
+		if (inputs == routes[i].drawn) {
+			continue;
+		}
+		routes[i].drawn.swap(inputs);
 
-	// Draw the routes
-	for (int i = 0; i < (int)routes.size(); i++) {
+		Layout layout(*tech);
 		if (routes[i].net >= 0) {
-			drawWire(routes[i].layout, *this, routes[i]);
+			drawWire(layout, *this, routes[i]);
 		} else {
-			drawStack(routes[i].layout, *ckt, this->stack[flip(routes[i].net)]);
+			drawStack(layout, *ckt, this->stack[flip(routes[i].net)]);
+		}
+
+		if (not sameGeometry(layout, routes[i].layout)) {
+			routes[i].layout = layout;
+			routes[i].dirty = true;
 		}
 	}
 }
 
-void Router::createRouteConstraint(int i, int j) {
+// Run DRC between two routes to find the spacing they need from each other
+// vertically. This returns false if they don't constrain each other.
+bool Router::measureRouteConstraint(int i, int j, RouteConstraint &result) const {
 	if (i > j) {
 		swap(i, j);
 	}
 
-	RouteConstraint result(i, j);
+	result = RouteConstraint(i, j);
 
 	//printf("checkout route %d:%d and %d:%d\n", i, routes[i].net, j, routes[j].net);
 	int routingMode = (
@@ -1749,7 +2080,7 @@ void Router::createRouteConstraint(int i, int j) {
 	bool tofrom = minOffset(&result.off[1], 1, routes[j].layout, 0, routes[i].layout, 0, Layout::DEFAULT, routingMode);
 
 	if ((allowOverCell or (routes[i].net >= 0 and routes[j].net >= 0)) and not fromto and not tofrom) {
-		return;
+		return false;
 	}
 
 	int select = -1;
@@ -1763,19 +2094,110 @@ void Router::createRouteConstraint(int i, int j) {
 		))  {
 		select = (flip(routes[j].net) == Model::PMOS or flip(routes[i].net) == Model::NMOS);
 	}
+	result.select = select;
+	return true;
+}
 
-	auto pos = lower_bound(routeConstraints.begin(), routeConstraints.end(), result);
+void Router::addRouteConstraint(const RouteConstraint &constraint) {
+	auto pos = lower_bound(routeConstraints.begin(), routeConstraints.end(), constraint);
 	int idx = pos - routeConstraints.begin();
-	if (pos == routeConstraints.end() or !(*pos == result)) {
-		routeConstraints.insert(pos, result);
+	if (pos == routeConstraints.end() or !(*pos == constraint)) {
+		routeConstraints.insert(pos, constraint);
 	} else {
-		pos->off[0] = max(pos->off[0], result.off[0]);
-		pos->off[1] = max(pos->off[1], result.off[1]);
+		pos->off[0] = max(pos->off[0], constraint.off[0]);
+		pos->off[1] = max(pos->off[1], constraint.off[1]);
+	}
+
+	if (routeConstraints[idx].select < 0 and constraint.select >= 0) {
+		routeConstraints[idx].select = constraint.select;
+	}
+}
+
+void Router::createRouteConstraint(int i, int j) {
+	RouteConstraint result;
+	if (measureRouteConstraint(i, j, result)) {
+		addRouteConstraint(result);
 	}
+}
+
+// Find the pairs of routes that might need a route constraint. Two routes
+// on nets can only constrain each other vertically if their geometry overlaps
+// horizontally once padded by the spacing rules. See createRouteConstraint()
+vector<pair<int, int> > Router::nearbyRoutes() const {
+	struct Extent {
+		int draw;
+		int left;
+		int right;
+	};
+
+	// Horizontal extent of each layer of each route
+	int n = (int)routes.size();
+	vector<vector<Extent> > extents(n, vector<Extent>());
+	for (int i = 0; i < n; i++) {
+		for (auto layer = routes[i].layout.layers.begin(); layer != routes[i].layout.layers.end(); layer++) {
+			if (layer->geo.empty()) {
+				continue;
+			}
+			Extent e{layer->draw, numeric_limits<int>::max(), numeric_limits<int>::min()};
+			for (auto r = layer->geo.begin(); r != layer->geo.end(); r++) {
+				e.left = min(e.left, min(r->ll[0], r->ur[0]));
+				e.right = max(e.right, max(r->ll[0], r->ur[0]));
+			}
+			extents[i].push_back(e);
+		}
+	}
+
+	// Stacks always interact with everything, so sweep over the remaining
+	// routes by their left edge.
+	vector<pair<int, int> > result;
+	vector<pair<vec2i, int> > sweep;
+	for (int i = 0; i < n; i++) {
+		if (routes[i].net < 0) {
+			for (int j = 0; j < n; j++) {
+				if (j != i and (routes[j].net >= 0 or j > i)) {
+					result.push_back(pair<int, int>(min(i, j), max(i, j)));
+				}
+			}
+		} else if (not extents[i].empty()) {
+			vec2i box(numeric_limits<int>::max(), numeric_limits<int>::min());
+			for (auto e = extents[i].begin(); e != extents[i].end(); e++) {
+				box[0] = min(box[0], e->left);
+				box[1] = max(box[1], e->right);
+			}
+			sweep.push_back(pair<vec2i, int>(box, i));
+		}
+	}
+	sort(sweep.begin(), sweep.end(), [](const pair<vec2i, int> &a, const pair<vec2i, int> &b) {
+		return a.first[0] < b.first[0] or (a.first[0] == b.first[0] and a.second < b.second);
+	});
+
+	vector<pair<vec2i, int> > active;
+	for (auto curr = sweep.begin(); curr != sweep.end(); curr++) {
+		for (int k = (int)active.size()-1; k >= 0; k--) {
+			if (active[k].first[1] + spacing < curr->first[0]) {
+				active[k] = active.back();
+				active.pop_back();
+			}
+		}
 
-	if (routeConstraints[idx].select < 0 and select >= 0) {
-		routeConstraints[idx].select = select;
+		int i = curr->second;
+		for (auto other = active.begin(); other != active.end(); other++) {
+			int j = other->second;
+			bool near = false;
+			for (auto e0 = extents[i].begin(); not near and e0 != extents[i].end(); e0++) {
+				for (auto e1 = extents[j].begin(); not near and e1 != extents[j].end(); e1++) {
+					int rule = max(0, tech->getSpacing(e0->draw, e1->draw));
+					near = e0->left < e1->right + rule and e1->left < e0->right + rule;
+				}
+			}
+			if (near) {
+				result.push_back(pair<int, int>(min(i, j), max(i, j)));
+			}
+		}
+		active.push_back(*curr);
 	}
+
+	return result;
 }
 
 bool Router::buildRouteConstraints(bool resetSpacing, bool resetOrder) {
@@ -1783,11 +2205,29 @@ bool Router::buildRouteConstraints(bool resetSpacing, bool resetOrder) {
 	bool change = false;
 	vector<RouteConstraint> old;
 	old.swap(routeConstraints);
-	for (int i = 0; i < (int)routes.size(); i++) {
-		for (int j = i+1; j < (int)routes.size(); j++) {
-			createRouteConstraint(i, j);
+
+	// Only run DRC on pairs of routes where one of them has changed
+	vector<RouteConstraint> spacing;
+	vector<pair<int, int> > pairs = nearbyRoutes();
+	for (auto p = pairs.begin(); p != pairs.end(); p++) {
+		RouteConstraint result(p->first, p->second);
+		if (not routes[p->first].dirty and not routes[p->second].dirty) {
+			auto pos = lower_bound(routeSpacing.begin(), routeSpacing.end(), result);
+			if (pos != routeSpacing.end() and *pos == result) {
+				spacing.push_back(*pos);
+			}
+		} else if (measureRouteConstraint(p->first, p->second, result)) {
+			spacing.push_back(result);
 		}
 	}
+	sort(spacing.begin(), spacing.end());
+	for (auto c = spacing.begin(); c != spacing.end(); c++) {
+		addRouteConstraint(*c);
+	}
+	routeSpacing.swap(spacing);
+	for (auto r = routes.begin(); r != routes.end(); r++) {
+		r->dirty = false;
+	}
 
 	if (not resetOrder or not resetSpacing) {
 		int i = 0, j = 0;
@@ -1838,6 +2278,7 @@ bool Router::buildRouteConstraints(bool resetSpacing, bool resetOrder) {
 			}
 		}
 	}
+	indexRouteConstraints();
 	return change;
 }
 
@@ -1942,53 +2383,134 @@ bool Router::buildPinBounds(bool reset) {
 	return change;
 }
 
+// Push routes away from the stack until all of the constraints reachable from
+// start are satisfied. If start is empty, then every route is considered.
 bool Router::buildOffsets(int type, vector<int> start) {
 	bool change = false;
 	unresolvedCycle[type] = false;
+
+	// Once breakCycles() has run, the constraint graph should be acyclic, which
+	// makes this a longest path problem. So we visit the routes in topological
+	// order (Kahn's algorithm), relaxing each arc exactly once. Anything left
+	// over when the queue runs dry is on or downstream of a cycle.
+
+	// TODO(edward.bingham) for routes that are on the wrong side of the
+	// PMOS stack, this fails to update their poffset.
+
+	int n = (int)routes.size();
+	vector<vector<pair<int, int> > > arcs(n, vector<pair<int, int> >());
+	vector<bool> reached(n, false);
+	vector<int> reachable;
 	if (start.empty()) {
-		vector<bitset> prev = routeOrderMap(type);
-		for (int i = 0; i < (int)prev.size(); i++) {
-			if (prev[i].empty()) {
-				start.push_back(i);
+		for (int i = 0; i < n; i++) {
+			start.push_back(i);
+		}
+	}
+	for (auto i = start.begin(); i != start.end(); i++) {
+		if (not reached[*i]) {
+			reached[*i] = true;
+			reachable.push_back(*i);
+		}
+	}
+	for (int k = 0; k < (int)reachable.size(); k++) {
+		int v = reachable[k];
+		map<int, int> m = type == Model::PMOS ? next(v) : prev(v);
+		arcs[v].assign(m.begin(), m.end());
+		for (auto a = arcs[v].begin(); a != arcs[v].end(); a++) {
+			if (not reached[a->first]) {
+				reached[a->first] = true;
+				reachable.push_back(a->first);
 			}
 		}
 	}
 
-	// TODO(edward.bingham) for routes that are on the wrong side of the
-	// PMOS stack, this fails to update their poffset.
+	vector<int> indeg(n, 0);
+	for (auto v = reachable.begin(); v != reachable.end(); v++) {
+		for (auto a = arcs[*v].begin(); a != arcs[*v].end(); a++) {
+			indeg[a->first]++;
+		}
+	}
 
-	vector<vector<int> > tokens;
-	sort(start.begin(), start.end());
-	start.erase(unique(start.begin(), start.end()), start.end());
-	for (int i = 0; i < (int)start.size(); i++) {
-		tokens.push_back(vector<int>(1, start[i]));
-	}
-	while (not tokens.empty()) {
-		vector<int> curr = tokens.back();
-		tokens.pop_back();
-
-		map<int, int> n = type == Model::PMOS ? next(curr.back()) : prev(curr.back());
-		for (auto i = n.begin(); i != n.end(); i++) {
-			auto pos = find(curr.begin(), curr.end(), i->first);
-			if (pos == curr.end()) {
-				int weight = routes[curr.back()].offset[type] + i->second;
-				if (routes[i->first].offset[type] < weight) {
-					change = true;
-					routes[i->first].offset[type] = weight;
+	vector<int> ready;
+	for (auto v = reachable.begin(); v != reachable.end(); v++) {
+		if (indeg[*v] == 0) {
+			ready.push_back(*v);
+		}
+	}
 
-					tokens.push_back(curr);
-					tokens.back().push_back(i->first);
+	int done = 0;
+	while (not ready.empty()) {
+		int v = ready.back();
+		ready.pop_back();
+		done++;
+		for (auto a = arcs[v].begin(); a != arcs[v].end(); a++) {
+			int weight = routes[v].offset[type] + a->second;
+			if (routes[a->first].offset[type] < weight) {
+				change = true;
+				routes[a->first].offset[type] = weight;
+			}
+			if (--indeg[a->first] == 0) {
+				ready.push_back(a->first);
+			}
+		}
+	}
+
+	if (done < (int)reachable.size()) {
+		unresolvedCycle[type] = true;
+
+		vector<int> residual;
+		for (auto v = reachable.begin(); v != reachable.end(); v++) {
+			if (indeg[*v] > 0) {
+				residual.push_back(*v);
+			}
+		}
+
+		// Every residual route has a residual predecessor, so walking
+		// backwards from any of them must eventually repeat a route. That
+		// repetition is the cycle.
+		if (debug) {
+			vector<int> pred(n, -1);
+			for (auto v = residual.begin(); v != residual.end(); v++) {
+				for (auto a = arcs[*v].begin(); a != arcs[*v].end(); a++) {
+					if (indeg[a->first] > 0) {
+						pred[a->first] = *v;
+					}
 				}
-			} else {
-				unresolvedCycle[type] = true;
-				if (debug) {
-					printf("error: buildOffset found cycle {");
-					for (int j = 0; j < (int)curr.size(); j++) {
-						printf("%d:%s(%d) ", curr[j], curr[j] >= 0 ? ckt->nets[routes[curr[j]].net].name.c_str() : "", routes[curr[j]].net);
+			}
+
+			vector<int> seen(n, -1);
+			vector<int> path;
+			int v = residual[0];
+			while (seen[v] < 0) {
+				seen[v] = (int)path.size();
+				path.push_back(v);
+				v = pred[v];
+			}
+			printf("error: buildOffset found cycle {");
+			for (int j = (int)path.size()-1; j >= seen[v]; j--) {
+				printf("%d:%s(%d) ", path[j], routes[path[j]].net >= 0 ? ckt->nets[routes[path[j]].net].name.c_str() : "", routes[path[j]].net);
+			}
+			printf("%d:%s(%d)}\n", v, routes[v].net >= 0 ? ckt->nets[routes[v].net].name.c_str() : "", routes[v].net);
+		}
+
+		// Give the routes on and after the cycle reasonable offsets anyway by
+		// relaxing along paths of bounded length. The cycle can't be satisfied,
+		// so this doesn't try to.
+		for (int round = 0; round < (int)residual.size(); round++) {
+			bool relaxed = false;
+			for (auto v = residual.begin(); v != residual.end(); v++) {
+				for (auto a = arcs[*v].begin(); a != arcs[*v].end(); a++) {
+					int weight = routes[*v].offset[type] + a->second;
+					if (indeg[a->first] > 0 and routes[a->first].offset[type] < weight) {
+						change = true;
+						relaxed = true;
+						routes[a->first].offset[type] = weight;
 					}
-					printf("%d:%s(%d)}\n", i->first, i->first >= 0 ? ckt->nets[routes[i->first].net].name.c_str() : "", routes[i->first].net);
 				}
 			}
+			if (not relaxed) {
+				break;
+			}
 		}
 	}
 	
@@ -2037,7 +2559,7 @@ bool Router::assignRouteConstraints(bool reset) {
 		}
 	}
 
-	vector<bitset> prev = routeOrderMap(Model::PMOS);
+	bitmatrix prev = routeOrderMap(Model::PMOS);
 
 	while (unassigned.size() > 0) {
 		// handle critical constraints, that would create cycles if assigned the wrong direction.
@@ -2062,13 +2584,13 @@ bool Router::assignRouteConstraints(bool reset) {
 			int a = routeConstraints[i].wires[0];
 			int b = routeConstraints[i].wires[1];
 
-			if (a >= 0 and prev[a].get(b)) {
+			if (a >= 0 and prev.get(a, b)) {
 				change = true;
 				routeConstraints[i].select = 1;
 				inTokens.push_back(b);
 				outTokens.push_back(a);
 				unassigned.erase(unassigned.begin()+u);
-			} else if (b >= 0 and prev[b].get(a)) {
+			} else if (b >= 0 and prev.get(b, a)) {
 				change = true;
 				routeConstraints[i].select = 0;
 				inTokens.push_back(a);
@@ -7,6 +7,8 @@
 #include <unordered_set>
 #include <array>
 #include <vector>
+#include <memory>
+#include <random>
 #include "Constraint.h"
 #include "bitset.h"
 
@@ -15,6 +17,31 @@ using namespace std;
 namespace sch {
 
 struct Router;
+struct SpacingCache;
+
+// A map from pins to spacing offsets, stored as an array sorted by pin. These
+// only ever hold a handful of entries and there is one of them on every pin
+// and contact, so this avoids allocating a tree node per entry. It declares
+// no constructors or destructor of its own so that it keeps its implicit
+// move operations, which Pin and Contact rely upon.
+struct OffsetMap {
+	typedef vector<pair<Index, int> >::iterator iterator;
+	typedef vector<pair<Index, int> >::const_iterator const_iterator;
+
+	vector<pair<Index, int> > entries;
+
+	pair<iterator, bool> insert(pair<Index, int> value);
+	iterator find(Index pin);
+	const_iterator find(Index pin) const;
+
+	iterator begin();
+	iterator end();
+	const_iterator begin() const;
+	const_iterator end() const;
+	int size() const;
+	bool empty() const;
+	void clear();
+};
 
 // A Pin represents either a gate of a transistor or a source/drain connection
 // (called contacts). The list of Pins in a cell is given to us by the placer.
@@ -26,8 +53,13 @@ struct Pin {
 	Pin(const Tech &tech, int outNet, int baseNet);
 	// Construct a "gate" pin
 	Pin(const Tech &tech, int device, int outNet, int leftNet, int rightNet, int baseNet);
+	Pin(const Pin &pin) = default;
+	Pin(Pin &&pin) = default;
 	~Pin();
 
+	Pin &operator=(const Pin &pin) = default;
+	Pin &operator=(Pin &&pin) = default;
+
 	// inNet == outNet == gateNet for contacts
 	// inNet and outNet represent source and drain depending on Placer::Device::flip
 	// These index into Subckt::nets
@@ -63,7 +95,7 @@ struct Pin {
 	// |==|==|
 	//  ---->
 	//  ->
-	map<Index, int> toPin;
+	OffsetMap toPin;
 	// current absolute position, computed from off, pin alignment, via constraints
 	int pos;
 
@@ -85,8 +117,13 @@ struct Pin {
 struct Contact {
 	Contact(const Tech &tech);
 	Contact(const Tech &tech, Index idx);
+	Contact(const Contact &ct) = default;
+	Contact(Contact &&ct) = default;
 	~Contact();
 
+	Contact &operator=(const Contact &ct) = default;
+	Contact &operator=(Contact &&ct) = default;
+
 	// index of the pin this contact connects to	
 	Index idx;
 	// the minimum and maximum X coordinate (horizontal) of this pin in the
@@ -106,7 +143,7 @@ struct Contact {
 	//       O
 	//  ---->
 	//     ->
-	map<Index, int> fromPin;
+	OffsetMap fromPin;
 
 	// Minimum required spacing from other pins to the left of
 	// this via to this via. "from" indexes into Subckt::stack, "offset" is
@@ -116,7 +153,7 @@ struct Contact {
 	// O
 	//  ---->
 	//  ->
-	map<Index, int> toPin;
+	OffsetMap toPin;
 
 	bool offsetFromPin(Index Pin, int value);
 	bool offsetToPin(Index Pin, int value);
@@ -148,8 +185,13 @@ struct CompareIndex {
 struct Wire {
 	Wire(const Tech &tech);
 	Wire(const Tech &tech, int net);
+	Wire(const Wire &w) = default;
+	Wire(Wire &&w) = default;
 	~Wire();
 
+	Wire &operator=(const Wire &w) = default;
+	Wire &operator=(Wire &&w) = default;
+
 	// If this positive, then this indexes into Subckt::nets
 	// If this is negative, then flip(net) indexes into Subckt::stack to represent a stack.
 	int net;
@@ -178,6 +220,10 @@ struct Wire {
 	// This is the actual geometry for this wire. See phy/Layout.h
 	// This is generated by Draw::drawWire()
 	Layout layout;
+	// Everything that layout was drawn from, see Router::drawRoutes(). The
+	// layout is only redrawn when this changes, and it is empty if the layout
+	// hasn't been drawn yet.
+	vector<int> drawn;
 
 	// The layout of a cell is drawn such that the PMOS stack is on bottom and
 	// the NMOS stack is on top. The coordinate system for pOffset starts from
@@ -190,6 +236,10 @@ struct Wire {
 	// The vertical distance from the [NMOS,PMOS] stack to this wire.
 	array<int, 2> offset;
 
+	// True if the contacts or the layout of this wire have changed since the
+	// last time buildRouteConstraints() checked it against the other wires.
+	bool dirty;
+
 	void addPin(const Router *rt, Contact pin);
 	int findPin(const Router *rt, Index pin) const;
 	bool hasPin(const Router *rt, Index pin) const;
@@ -217,12 +267,21 @@ struct Stack {
 	int route;
 	
 	void push(const Tech &tech, const Subckt &ckt, int device, bool flip);
+
+	// Whether pins[pin] is the contact that starts a run of transistors,
+	// either at the left edge of the stack or right after a break in the
+	// diffusion, which push() leaves as two contacts in a row.
+	bool isStart(int pin) const;
 };
 
 
 
 struct Router {
-	Router(const Tech &tech, const Placement &place, bool progress=false, bool debug=false);
+	// The spacing checks between pins and vias go through cache, which must be
+	// for the same technology. If it is null, the router makes its own. Ties
+	// are broken with a random engine seeded with seed, so the same cell and
+	// seed always route the same way.
+	Router(const Tech &tech, const Placement &place, bool progress=false, bool debug=false, SpacingCache *cache=nullptr, unsigned seed=0);
 	~Router();
 
 	bool progress;
@@ -233,6 +292,19 @@ struct Router {
 	const Tech *tech;
 	const Subckt *ckt;
 
+	// The largest spacing rule between any two layers, see maxSpacing().
+	// Shapes farther apart than this can't interact, so the DRC prefilters
+	// skip them.
+	int spacing;
+
+	// Memoizes the spacing checks between pins and vias, see SpacingCache.
+	// ownCache is only set if the router made its own.
+	SpacingCache *cache;
+	unique_ptr<SpacingCache> ownCache;
+
+	// Breaks ties between route orderings in assignRouteConstraints()
+	std::default_random_engine rand;
+
 	bool allowOverCell;
 
 	// Computed by the placement system
@@ -248,6 +320,32 @@ struct Router {
 	vector<ViaConstraint> viaConstraints;
 	vector<RouteGroupConstraint> groupConstraints;
 
+	// The constraints above are stored by what they constrain rather than by
+	// which routes they connect, which makes it expensive to walk the
+	// constraint graph. The following index them by route. buildRoutes(),
+	// delRoute(), breakRoute(), buildPinConstraints(), and
+	// buildRouteConstraints() keep them up to date. The direction of a route
+	// constraint (RouteConstraint::select) is checked when the graph is walked,
+	// so it may be changed freely.
+
+	// pinRoutes[type][pin] lists the routes with a contact on
+	// stack[type].pins[pin]
+	array<vector<vector<int> >, 3> pinRoutes;
+	// pinsTo[from] lists the NMOS pins constrained by the PMOS pin "from" and
+	// pinsFrom[to] lists the PMOS pins constraining the NMOS pin "to". See
+	// PinConstraint
+	vector<vector<int> > pinsTo;
+	vector<vector<int> > pinsFrom;
+	// routeArcs[route] lists the indices into routeConstraints that involve route
+	vector<vector<int> > routeArcs;
+
+	// Running DRC between pairs of routes is the most expensive part of
+	// solve(), and most routes don't move from one iteration to the next.
+	// routeSpacing keeps the route constraints exactly as
+	// measureRouteConstraint() found them the last time buildRouteConstraints()
+	// ran, so that pairs of routes that aren't Wire::dirty can reuse them.
+	vector<RouteConstraint> routeSpacing;
+
 	int cellHeight;
 	int cycleCount;
 	int cost;
@@ -263,14 +361,19 @@ struct Router {
 	map<int, int> prev(int i);
 
 	bool hasPinConstraint(int from, int to);
-	vector<bitset> routeOrderMap(int type);
+
+	void indexRoute(int route);
+	void unindexRoute(int route);
+	void indexRoutes();
+	void indexPinConstraints();
+	void indexRouteConstraints();
+	bitmatrix routeOrderMap(int type);
 
 	// Finish building the constraint graph, filling out vcon and hcon.
 	void delRoute(int route);
 	bool buildPinConstraints(int level=1, bool reset=false);
 	void buildViaConstraints();
 	void buildRoutes();
-	bool findCycle(int s, const vector<set<int> > &Ak, vector<pair<int, set<int> > > &cycles);
 	bool findCycles(vector<pair<int, set<int> > > &cycles);
 	bool breakRoute(int route, set<int> cycleRoutes);
 	bool breakCycles();
@@ -283,7 +386,10 @@ struct Router {
 	bool updatePinPos(bool reset=false);
 	bool alignPins(int maxDist = -1, bool reset=false);
 	void drawRoutes();
+	bool measureRouteConstraint(int i, int j, RouteConstraint &result) const;
+	void addRouteConstraint(const RouteConstraint &constraint);
 	void createRouteConstraint(int i, int j);
+	vector<pair<int, int> > nearbyRoutes() const;
 	bool buildRouteConstraints(bool resetSpacing=false, bool resetOrder=false);
 	void buildGroupConstraints();
 	set<int> propagateRouteConstraint(int idx);
@@ -204,15 +204,18 @@ Subckt::~Subckt() {
 }
 
 int Subckt::findNet(string name, bool create) {
-	for (int i = 0; i < (int)nets.size(); i++) {
-		if (nets[i].name == name) {
-			return i;
+	// If there are multiple nets with the same name, return the first one
+	int result = -1;
+	auto range = netIndex.equal_range(std::hash<string>{}(name));
+	for (auto i = range.first; i != range.second; i++) {
+		if ((result < 0 or i->second < result) and nets[i->second].name == name) {
+			result = i->second;
 		}
 	}
-	if (create) {
+	if (result < 0 and create) {
 		return pushNet(name);
 	}
-	return -1;
+	return result;
 }
 
 string Subckt::netName(int net) const {
@@ -223,10 +226,33 @@ string Subckt::netName(int net) const {
 	return nets[net].name;
 }
 
+void Subckt::renameNet(int net, string name) {
+	auto range = netIndex.equal_range(std::hash<string>{}(nets[net].name));
+	for (auto i = range.first; i != range.second; i++) {
+		if (i->second == net) {
+			netIndex.erase(i);
+			break;
+		}
+	}
+
+	nets[net].name = name;
+	netIndex.insert(pair<size_t, int>(std::hash<string>{}(name), net));
+}
+
+// Rebuild netIndex from scratch. This is needed any time nets are renumbered.
+void Subckt::indexNets() {
+	netIndex.clear();
+	netIndex.reserve(nets.size());
+	for (int i = 0; i < (int)nets.size(); i++) {
+		netIndex.insert(pair<size_t, int>(std::hash<string>{}(nets[i].name), i));
+	}
+}
+
 int Subckt::pushNet(string name, bool isIO) {
 	int result = (int)nets.size();
 	nets.push_back(Net(name, isIO));
 	nets.back().remote.push_back(result);
+	netIndex.insert(pair<size_t, int>(std::hash<string>{}(name), result));
 	if (isIO) {
 		ports.push_back(result);
 	}
@@ -235,6 +261,7 @@ int Subckt::pushNet(string name, bool isIO) {
 
 void Subckt::popNet(int index) {
 	nets.erase(nets.begin()+index);
+	indexNets();
 
 	for (int i = (int)ports.size()-1; i >= 0; i--) {
 		if (ports[i] > index) {
@@ -271,6 +298,49 @@ void Subckt::popNet(int index) {
 	}
 }
 
+// Remove many nets at once. Calling popNet(int) for each net rescans every
+// device once per net. This builds a single old->new index table instead and
+// renumbers everything in one pass.
+void Subckt::popNet(vector<int> index) {
+	sort(index.begin(), index.end());
+	index.erase(unique(index.begin(), index.end()), index.end());
+	if (index.empty()) {
+		return;
+	}
+
+	vector<int> remap(nets.size(), -1);
+	int count = 0;
+	auto rem = index.begin();
+	for (int i = 0; i < (int)nets.size(); i++) {
+		if (rem != index.end() and *rem == i) {
+			rem++;
+		} else {
+			remap[i] = count;
+			if (count != i) {
+				nets[count] = std::move(nets[i]);
+			}
+			count++;
+		}
+	}
+	nets.resize(count);
+	indexNets();
+
+	int j = 0;
+	for (int i = 0; i < (int)ports.size(); i++) {
+		if (remap[ports[i]] >= 0) {
+			ports[j++] = remap[ports[i]];
+		}
+	}
+	ports.resize(j);
+
+	for (auto d = mos.begin(); d != mos.end(); d++) {
+		d->gate = d->gate >= 0 ? remap[d->gate] : d->gate;
+		d->source = d->source >= 0 ? remap[d->source] : d->source;
+		d->drain = d->drain >= 0 ? remap[d->drain] : d->drain;
+		d->base = d->base >= 0 ? remap[d->base] : d->base;
+	}
+}
+
 void Subckt::connectRemote(int n0, int n1) {
 	nets[n0].remote.push_back(n1);
 	nets[n1].remote.push_back(n0);
@@ -352,6 +422,52 @@ void Subckt::popMos(int index) {
 	}
 }
 
+// Remove many devices at once. Calling popMos(int) for each device rescans
+// the adjacency lists of every net once per device. This compacts
+// Subckt::mos in a single pass and rewrites all of the adjacency lists through
+// one old->new index table.
+void Subckt::popMos(vector<int> index) {
+	sort(index.begin(), index.end());
+	index.erase(unique(index.begin(), index.end()), index.end());
+	if (index.empty()) {
+		return;
+	}
+
+	vector<int> remap(mos.size(), -1);
+	int count = 0;
+	auto rem = index.begin();
+	for (int i = 0; i < (int)mos.size(); i++) {
+		if (rem != index.end() and *rem == i) {
+			rem++;
+		} else {
+			remap[i] = count;
+			if (count != i) {
+				mos[count] = std::move(mos[i]);
+			}
+			count++;
+		}
+	}
+	mos.resize(count);
+
+	auto renumber = [&remap](vector<int> &devs) {
+		int j = 0;
+		for (int i = 0; i < (int)devs.size(); i++) {
+			if (remap[devs[i]] >= 0) {
+				devs[j++] = remap[devs[i]];
+			}
+		}
+		devs.resize(j);
+	};
+
+	for (auto n = nets.begin(); n != nets.end(); n++) {
+		for (int type = 0; type < 2; type++) {
+			renumber(n->gateOf[type]);
+			renumber(n->sourceOf[type]);
+			renumber(n->drainOf[type]);
+		}
+	}
+}
+
 void Subckt::pushInst(Instance ckt) {
 	int index = (int)inst.size();
 	inst.push_back(ckt);
@@ -361,17 +477,17 @@ void Subckt::pushInst(Instance ckt) {
 }
 
 void Subckt::extract(const Segment &seg) {
-	for (int i = (int)seg.mos.size()-1; i >= 0; i--) {
-		popMos(seg.mos[i]);
-	}
+	popMos(seg.mos);
 }
 
 void Subckt::cleanDangling(bool remIO) {
-	for (int i = (int)nets.size()-1; i >= 0; i--) {
+	vector<int> dangling;
+	for (int i = 0; i < (int)nets.size(); i++) {
 		if (nets[i].dangling(remIO)) {
-			popNet(i);
+			dangling.push_back(i);
 		}
 	}
+	popNet(dangling);
 }
 
 Segment Subckt::segment(int net, set<int> *covered) {
@@ -518,26 +634,32 @@ bool Subckt::areCoupled(const Segment &s0, const Segment &s1) const {
 }
 
 void Subckt::apply(const Mapping &m) {
+	// m maps new net indices to old ones, but the terminals need old -> new
+	vector<int> inv(nets.size(), -1);
+	for (int i = 0; i < (int)m.nets.size(); i++) {
+		inv[m.nets[i]] = i;
+	}
+
 	for (int i = 0; i < (int)ports.size(); i++) {
-		ports[i] = m.nets[ports[i]];
+		ports[i] = inv[ports[i]];
 	}
 
 	for (int i = 0; i < (int)mos.size(); i++) {
-		mos[i].gate = m.nets[mos[i].gate];
-		mos[i].source = m.nets[mos[i].source];
-		mos[i].drain = m.nets[mos[i].drain];
-		mos[i].base = m.nets[mos[i].base];
+		mos[i].gate = mos[i].gate >= 0 ? inv[mos[i].gate] : mos[i].gate;
+		mos[i].source = mos[i].source >= 0 ? inv[mos[i].source] : mos[i].source;
+		mos[i].drain = mos[i].drain >= 0 ? inv[mos[i].drain] : mos[i].drain;
+		mos[i].base = mos[i].base >= 0 ? inv[mos[i].base] : mos[i].base;
 	}
 
 	for (int i = 0; i < (int)nets.size(); i++) {
 		for (int j = 0; j < (int)nets[i].remote.size(); j++) {
-			nets[i].remote[j] = m.nets[nets[i].remote[j]];
+			nets[i].remote[j] = inv[nets[i].remote[j]];
 		}
 	}
 
 	for (int i = 0; i < (int)inst.size(); i++) {
 		for (int j = 0; j < (int)inst[i].ports.size(); j++) {
-			inst[i].ports[j] = m.nets[inst[i].ports[j]];
+			inst[i].ports[j] = inst[i].ports[j] >= 0 ? inv[inst[i].ports[j]] : inst[i].ports[j];
 		}
 	}
 
@@ -548,10 +670,11 @@ void Subckt::apply(const Mapping &m) {
 	}
 	std::swap(nets, reorder);
 	reorder.clear();
+	indexNets();
 }
 
 Mapping Subckt::canonicalize() {
-	Mapping lbl = canonicalLabels(*this);
+	Mapping lbl = canonicalLabels(Adjacency(*this));
 	apply(lbl);
 	id = std::hash<Subckt>{}(*this);
 	return lbl;
@@ -569,13 +692,13 @@ int Subckt::compare(const Subckt &ckt) const {
 		auto n1 = ckt.nets.begin()+i;
 		
 		for (int type = 0; type < 2; type++) {
-			vector<int> g0, g1;
+			vector<pair<int, int> > g0, g1;
 			for (auto j = n0->sourceOf[type].begin(); j != n0->sourceOf[type].end(); j++) {
-				g0.push_back(mos[*j].drain);
+				g0.push_back(pair<int, int>(mos[*j].drain, mos[*j].gate));
 			}
 			sort(g0.begin(), g0.end());
 			for (auto j = n1->sourceOf[type].begin(); j != n1->sourceOf[type].end(); j++) {
-				g1.push_back(ckt.mos[*j].drain);
+				g1.push_back(pair<int, int>(ckt.mos[*j].drain, ckt.mos[*j].gate));
 			}
 			sort(g1.begin(), g1.end());
 
@@ -583,7 +706,7 @@ int Subckt::compare(const Subckt &ckt) const {
 			for (int j = 0; j < m; j++) {
 				if (g0[j] < g1[j]) {
 					return -1;
-				} else if (g0[j] > g1[j]) {
+				} else if (g1[j] < g0[j]) {
 					return 1;
 				}
 			}
@@ -598,99 +721,17 @@ int Subckt::compare(const Subckt &ckt) const {
 	return 0;
 }
 
-vector<vector<int> > Subckt::createPartitionKey(int net, const Partition &beta) const {
-	const int N = 3;
-	vector<vector<int> > result;
-	for (auto c = beta.cells.begin(); c != beta.cells.end(); c++) {
-		vector<int> score(2*N+1, 0);
-		score[2*N + 0] = nets[net].isIO or not nets[net].gateOf[0].empty() or not nets[net].gateOf[1].empty();
-		for (int type = 0; type < 2; type++) {
-			for (auto i = nets[net].drainOf[type].begin(); i != nets[net].drainOf[type].end(); i++) {
-				score[type*N + 0] += (std::find(c->begin(), c->end(), mos[*i].source) != c->end());
-			}
-			for (auto i = nets[net].sourceOf[type].begin(); i != nets[net].sourceOf[type].end(); i++) {
-				score[type*N + 1] += (std::find(c->begin(), c->end(), mos[*i].drain) != c->end());
-			}
-			for (auto i = nets[net].gateOf[type].begin(); i != nets[net].gateOf[type].end(); i++) {
-				score[type*N + 2] += (std::find(c->begin(), c->end(), mos[*i].gate) != c->end());
-			}
-		}
-		result.push_back(score);
-	}
-	return result;
-}
-
-// Lambda functions are indicator functions that are used to prune the search
-// tree. They must be invariant between graph isomorphisms and
-// lexicographically comparable.
-//
-// Compute the following:
-//   1. number of connections from drain in c0 to source in c1 through nmos
-//   2. number of connections from drain in c0 to source in c1 through pmos
-//   3. number of connections from drain in c0 to gate in c1 through nmos
-//   4. number of connections from drain in c0 to gate in c1 through pmos
-array<int, 4> Subckt::lambda(const Partition::Cell &c0, const Partition::Cell &c1) const {
-	array<int, 4> result;
-	if (c0.size() == 1 and c1.size() == 1 and c0[0] == c1[0]) {
-		return result;
-	}
-
-	for (auto i = c0.begin(); i != c0.end(); i++) {
-		auto n0 = nets.begin()+*i;
-
-		for (int type = 0; type < 2; type++) {
-			for (auto k = n0->drainOf[type].begin(); k != n0->drainOf[type].end(); k++) {
-				for (auto j = c1.begin(); j != c1.end(); j++) {
-					auto n1 = nets.begin()+*j;
-					if (n1->connectedTo(mos[*k].source)) {
-						result[0*2 + type]++;
-					}
-					if (n1->connectedTo(mos[*k].gate)) {
-						result[1*2 + type]++;
-					}
-				}
-			}
-		}
-	}
-	return result;
+// Nets that are ports of the cell must not be mapped onto internal nets
+int Subckt::color(int net) const {
+	return nets[net].isIO ? 1 : 0;
 }
 
-struct lambda_sort {
-    bool operator()(const vector<int> &a, const vector<int> &b) const {
-        return a.size() < b.size() or (a.size() == b.size() and not a.empty() and a[0] < b[0]);
-    }
-};
-
-vector<array<int, 4> > Subckt::lambda(Partition pi) const {
-	// consistent sort order
-	sort(pi.cells.begin(), pi.cells.end(), lambda_sort());
-
-	vector<array<int, 4> > result;
-	result.reserve(pi.cells.size()*pi.cells.size());
-	for (auto cell = pi.cells.begin(); cell != pi.cells.end(); cell++) {
-		result.push_back(lambda(*cell, *cell));
-	}
-
-	for (auto c0 = pi.cells.begin(); c0 != pi.cells.end(); c0++) {
-		for (auto c1 = pi.cells.begin(); c1 != pi.cells.end(); c1++) {
-			if (c0 != c1) {
-				result.push_back(lambda(*c0, *c1));
-			}
-		}
-	}
-	return result;
+// There are six edge colors for each transistor type. See adjacent()
+int Subckt::colors() const {
+	return 12;
 }
 
 int Subckt::comparePartitions(const Partition &pi0, const Partition &pi1) const {
-	/*if (pi0.size() > pi1.size()) {
-		return 1;
-	} else if (pi0.size() < pi1.size()) {
-		return -1;
-	}*/
-
-	/*if (not partitionIsDiscrete(pi0) or not partitionIsDiscrete(pi1) or pi0.size() != pi1.size()) {
-		printf("comparePartitions assumptions violated\n");
-	}*/
 	// implement G^pi0 <=> G^pi1
 	// The naive way would be to apply pi0 to G to create G0 and apply pi1 to G
 	// to create G1, then represent G0 and G1 as sorted adjacency lists and
@@ -699,19 +740,21 @@ int Subckt::comparePartitions(const Partition &pi0, const Partition &pi1) const
 
 	// The goal is to iterate through each mapping in lexographic order to
 	// generate the relevant edges to compare. This would prevent us from
-	// applying the whole mapping if we can determine order sooner.
+	// applying the whole mapping if we can determine order sooner. Every
+	// transistor is listed exactly once under its source, so this covers the
+	// whole graph.
 	for (int i = 0; i < (int)nets.size(); i++) {
-		auto n0 = nets.begin()+pi0.cells[i].back();
-		auto n1 = nets.begin()+pi1.cells[i].back();
+		auto n0 = nets.begin()+pi0.lab[i];
+		auto n1 = nets.begin()+pi1.lab[i];
 		
 		for (int type = 0; type < 2; type++) {
-			vector<int> g0, g1;
+			vector<pair<int, int> > g0, g1;
 			for (auto j = n0->sourceOf[type].begin(); j != n0->sourceOf[type].end(); j++) {
-				g0.push_back(pi0.cellOf(mos[*j].drain));
+				g0.push_back(pair<int, int>(pi0.pos[mos[*j].drain], pi0.pos[mos[*j].gate]));
 			}
 			sort(g0.begin(), g0.end());
 			for (auto j = n1->sourceOf[type].begin(); j != n1->sourceOf[type].end(); j++) {
-				g1.push_back(pi1.cellOf(mos[*j].drain));
+				g1.push_back(pair<int, int>(pi1.pos[mos[*j].drain], pi1.pos[mos[*j].gate]));
 			}
 			sort(g1.begin(), g1.end());
 
@@ -719,7 +762,7 @@ int Subckt::comparePartitions(const Partition &pi0, const Partition &pi1) const
 			for (int j = 0; j < m; j++) {
 				if (g0[j] < g1[j]) {
 					return -1;
-				} else if (g0[j] > g1[j]) {
+				} else if (g1[j] < g0[j]) {
 					return 1;
 				}
 			}
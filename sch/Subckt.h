@@ -5,6 +5,7 @@
 #include <string>
 #include <vector>
 #include <unordered_set>
+#include <unordered_map>
 #include <limits>
 #include <algorithm>
 
@@ -14,6 +15,7 @@
 
 #include "Mapping.h"
 #include "Isomorph.h"
+#include "Adjacency.h"
 
 using namespace phy;
 using namespace std;
@@ -125,15 +127,24 @@ struct Subckt {
 	vector<Mos> mos;
 	vector<Instance> inst;
 
+	// hash of net name -> index into nets. The names themselves are only stored
+	// in nets, so findNet() compares against Net::name to resolve collisions.
+	// Rename nets through renameNet() to keep this up to date.
+	unordered_multimap<size_t, int> netIndex;
+
 	int findNet(string name, bool create=false);
 	string netName(int net) const;
+	void renameNet(int net, string name);
+	void indexNets();
 
 	int pushNet(string name, bool isIO=false);
 	void popNet(int index);
+	void popNet(vector<int> index);
 	void connectRemote(int n0, int n1);
 	int pushMos(int model, int type, int drain, int gate, int source, int base=-1);
 	int pushMos(const Tech &tech, int model, int type, int drain, int gate, int source, int base, vec2i size);
 	void popMos(int index);
+	void popMos(vector<int> index);
 	void pushInst(Instance ckt);
 
 	void extract(const Segment &m);
@@ -148,12 +159,53 @@ struct Subckt {
 	int compare(const Subckt &ckt) const;
 
 
-	vector<vector<int> > createPartitionKey(int v, const Partition &beta) const;
-	array<int, 4> lambda(const Partition::Cell &c0, const Partition::Cell &c1) const;
-	vector<array<int, 4> > lambda(Partition pi) const;
+	// Implements the Graph concept used by canonicalLabels(). The vertices are
+	// the nets.
+	int color(int net) const;
+	int colors() const;
 	int comparePartitions(const Partition &pi0, const Partition &pi1) const;
 	int verts() const;
 
+	// Visit the nets that share a transistor with net. c = type*6 + role,
+	// where the roles are:
+	// 0. net is the source, visit the drain
+	// 1. net is the drain, visit the source
+	// 2. net is the gate, visit the source
+	// 3. net is the gate, visit the drain
+	// 4. net is the source, visit the gate
+	// 5. net is the drain, visit the gate
+	template <typename Visit>
+	void adjacent(int net, int c, Visit visit) const {
+		int type = c/6;
+		int role = c%6;
+		const Net &n = nets[net];
+		if (role == 0) {
+			for (auto i = n.sourceOf[type].begin(); i != n.sourceOf[type].end(); i++) {
+				visit(mos[*i].drain);
+			}
+		} else if (role == 1) {
+			for (auto i = n.drainOf[type].begin(); i != n.drainOf[type].end(); i++) {
+				visit(mos[*i].source);
+			}
+		} else if (role == 2) {
+			for (auto i = n.gateOf[type].begin(); i != n.gateOf[type].end(); i++) {
+				visit(mos[*i].source);
+			}
+		} else if (role == 3) {
+			for (auto i = n.gateOf[type].begin(); i != n.gateOf[type].end(); i++) {
+				visit(mos[*i].drain);
+			}
+		} else if (role == 4) {
+			for (auto i = n.sourceOf[type].begin(); i != n.sourceOf[type].end(); i++) {
+				visit(mos[*i].gate);
+			}
+		} else if (role == 5) {
+			for (auto i = n.drainOf[type].begin(); i != n.drainOf[type].end(); i++) {
+				visit(mos[*i].gate);
+			}
+		}
+	}
+
 
 	void printNet(int i) const;
 	void printMos(int i) const;
@@ -184,14 +236,15 @@ struct std::hash<sch::Subckt> {
 				appendHash(result, std::hash<int>{}(type));
 				appendHash(result, std::hash<size_t>{}(ckt.nets[i].sourceOf[type].size()));
 
-				vector<int> g0;
+				vector<pair<int, int> > g0;
 				for (auto j = ckt.nets[i].sourceOf[type].begin(); j != ckt.nets[i].sourceOf[type].end(); j++) {
-					g0.push_back(ckt.mos[*j].drain);
+					g0.push_back(pair<int, int>(ckt.mos[*j].drain, ckt.mos[*j].gate));
 				}
 				std::sort(g0.begin(), g0.end());
 
 				for (int j = 0; j < (int)g0.size(); j++) {
-					appendHash(result, std::hash<int>{}(g0[j]));
+					appendHash(result, std::hash<int>{}(g0[j].first));
+					appendHash(result, std::hash<int>{}(g0[j].second));
 				}
 			}
 		}
@@ -4,11 +4,21 @@
 #include "Draw.h"
 #include "Placer.h"
 #include "Router.h"
+#include "Parallel.h"
+#include "Adjacency.h"
+#include "Isomorph.h"
 
 #include <interpret_phy/import.h>
 #include <interpret_phy/export.h>
 
 #include <filesystem>
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <limits>
+#include <map>
+#include <queue>
+#include <set>
 
 #include <chrono>
 #define KNRM  "\x1B[0m"
@@ -24,27 +34,844 @@ using namespace phy;
 
 namespace sch {
 
-int routeCell(phy::Library &lib, Netlist &lst, int idx, bool progress, bool debug) {
+int routeCell(phy::Library &lib, Netlist &lst, int idx, bool progress, bool debug, const CellCache *cache, SpacingCache *spacing) {
+	int status = 0;
+	if (cache != nullptr and cache->load(lib.macros[idx], lst.subckts[idx], &status)) {
+		return status;
+	}
+
 	bool place = true;
 	bool route = true;
 	Placement pl = Placement::solve(lst.subckts[idx]);
-	Router rt(*lib.tech, pl, progress, debug);
+	Router rt(*lib.tech, pl, progress, debug, spacing, (unsigned)idx);
 	route = rt.solve();
 	drawCell(lib.macros[idx], rt);
 	rt.annotateAreaPerim(lst.subckts[idx]);
 	if (not place) {
-		return 1;
+		status = 1;
 	} else if (not route) {
-		return 2;
+		status = 2;
+	}
+
+	if (cache != nullptr) {
+		cache->save(lib.macros[idx], lst.subckts[idx], pl, status);
+	}
+	return status;
+}
+
+// Cell runtimes vary by orders of magnitude, so we hand out the cells with the
+// most transistors first. Otherwise one large cell picked up at the end of the
+// run keeps a single thread busy long after everything else has finished. Each
+// cell only writes to its own entry in lib.macros and lst.subckts.
+vector<int> routeLibrary(phy::Library &lib, Netlist &lst, bool progress, bool debug, const CellCache *cache, int threads) {
+	while (lib.macros.size() < lst.subckts.size()) {
+		lib.macros.push_back(Layout(*lib.tech));
+	}
+
+	vector<int> order;
+	order.reserve(lst.subckts.size());
+	for (int i = 0; i < (int)lst.subckts.size(); i++) {
+		order.push_back(i);
+	}
+	stable_sort(order.begin(), order.end(), [&](int a, int b) {
+		return lst.subckts[a].mos.size() > lst.subckts[b].mos.size();
+	});
+
+	if (progress) {
+		printf("Place and route cells:\n");
+	}
+	steady_clock::time_point start = steady_clock::now();
+
+	SpacingCache spacing(*lib.tech);
+	vector<int> status(lst.subckts.size(), 0);
+	parallelFor((int)order.size(), threads, [&](int k) {
+		int idx = order[k];
+		steady_clock::time_point cellStart = steady_clock::now();
+		status[idx] = routeCell(lib, lst, idx, false, debug, cache, &spacing);
+		steady_clock::time_point cellFinish = steady_clock::now();
+
+		if (progress) {
+			float elapsed = ((float)duration_cast<milliseconds>(cellFinish - cellStart).count())/1000.0;
+			if (status[idx] == 0) {
+				printf("  %s...[%sDONE%s %gs]\n", lst.subckts[idx].name.c_str(), KGRN, KNRM, elapsed);
+			} else {
+				printf("  %s...[%sFAILED %d%s %gs]\n", lst.subckts[idx].name.c_str(), KRED, status[idx], KNRM, elapsed);
+			}
+		}
+	});
+
+	steady_clock::time_point finish = steady_clock::now();
+	if (progress) {
+		printf("done [%gs]\n\n", ((float)duration_cast<milliseconds>(finish - start).count())/1000.0);
+	}
+	return status;
+}
+
+static int findRoot(vector<int> &parent, int i) {
+	while (parent[i] != i) {
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+	return i;
+}
+
+static void unite(vector<int> &parent, int a, int b) {
+	a = findRoot(parent, a);
+	b = findRoot(parent, b);
+	if (a != b) {
+		parent[max(a, b)] = min(a, b);
+	}
+}
+
+// Call fn(a, b) for every pair of rectangles in ids that overlap or touch.
+// This sorts the rectangles by their left edge and sweeps from left to right.
+// The rectangles that haven't ended yet are kept in a segment tree with one
+// leaf per rectangle ordered by bottom edge, where each node holds the
+// highest top edge below it. The next rectangle only has to look at leaves
+// that start below its top edge, and it can skip any subtree that ends
+// below its bottom edge, so each search visits O(log n) nodes per overlap.
+static void sweepRects(vector<int> ids, const vector<Rect> &rects, const function<void(int, int)> &fn) {
+	sort(ids.begin(), ids.end(), [&](int a, int b) {
+		return rects[a].ll[0] < rects[b].ll[0] or (rects[a].ll[0] == rects[b].ll[0] and a < b);
+	});
+
+	int n = (int)ids.size();
+	vector<int> order(n, 0);
+	for (int k = 0; k < n; k++) {
+		order[k] = k;
+	}
+	sort(order.begin(), order.end(), [&](int a, int b) {
+		return rects[ids[a]].ll[1] < rects[ids[b]].ll[1] or (rects[ids[a]].ll[1] == rects[ids[b]].ll[1] and a < b);
+	});
+	// leafOf[k] is the leaf of ids[k], and at[j] is the rectangle at leaf j
+	vector<int> leafOf(n, 0);
+	vector<int> bottom(n, 0);
+	for (int j = 0; j < n; j++) {
+		leafOf[order[j]] = j;
+		bottom[j] = rects[ids[order[j]]].ll[1];
 	}
-	return 0;
+	const vector<int> &at = order;
+
+	int size = 1;
+	while (size < n) {
+		size <<= 1;
+	}
+	vector<int> top(2*size, numeric_limits<int>::min());
+	auto set = [&](int leaf, int value) {
+		int i = size+leaf;
+		top[i] = value;
+		for (i >>= 1; i > 0; i >>= 1) {
+			top[i] = max(top[2*i], top[2*i+1]);
+		}
+	};
+
+	// The right edge of each active rectangle, so they can be removed once
+	// the sweep passes them
+	priority_queue<pair<int, int>, vector<pair<int, int> >, greater<pair<int, int> > > ends;
+	vector<array<int, 3> > stack;
+	for (int k = 0; k < n; k++) {
+		const Rect &r = rects[ids[k]];
+		while (not ends.empty() and ends.top().first < r.ll[0]) {
+			set(leafOf[ends.top().second], numeric_limits<int>::min());
+			ends.pop();
+		}
+
+		// Visit the leaves in [0, hi) whose top edge is at or above r's bottom
+		int hi = (int)(upper_bound(bottom.begin(), bottom.end(), r.ur[1]) - bottom.begin());
+		stack.assign(1, array<int, 3>{1, 0, size});
+		while (not stack.empty()) {
+			array<int, 3> node = stack.back();
+			stack.pop_back();
+			if (node[1] >= hi or top[node[0]] < r.ll[1]) {
+				continue;
+			}
+			if (node[2]-node[1] == 1) {
+				fn(ids[at[node[1]]], ids[k]);
+				continue;
+			}
+			int mid = (node[1]+node[2])/2;
+			stack.push_back(array<int, 3>{2*node[0]+1, mid, node[2]});
+			stack.push_back(array<int, 3>{2*node[0], node[1], mid});
+		}
+
+		set(leafOf[k], r.ur[1]);
+		ends.push(pair<int, int>(r.ur[0], k));
+	}
+}
+
+static int levelDraw(const Tech &tech, int level) {
+	return level >= 0 ? tech.wires[level].draw : tech.subst[flip(tech.models[flip(level)].stack[0])].draw;
 }
 
+// Extraction works on rectangles. Every rectangle on a conducting layer and
+// every via cut becomes a node in a union-find, and a sweep over each layer
+// unites the rectangles that touch. Cuts take part in the sweeps of the layers
+// above and below them. Poly splits diffusion into source and drain, so the
+// diffusion is cut along the poly before the sweep. Each place where poly
+// crosses diffusion becomes a transistor whose model is picked by the substrate
+// layers that cover the channel.
 Subckt extract(const Layout &geo) {
-	Subckt ckt;
+	const Tech &tech = *geo.tech;
+	Subckt ckt(true);
+	ckt.name = geo.name;
+
+	int poly = tech.wires[0].draw;
+
+	// Map each drawing layer to the conducting layer it connects to. Pin
+	// layers are connected to their routing layer.
+	map<int, int> conductor;
+	map<int, bool> isWell;
+	for (int i = 0; i < (int)tech.wires.size(); i++) {
+		conductor[tech.wires[i].draw] = tech.wires[i].draw;
+		if (tech.wires[i].pin >= 0) {
+			conductor[tech.wires[i].pin] = tech.wires[i].draw;
+		}
+	}
+	// Wells aren't conductors here. drawCell() doesn't draw taps, so a well
+	// isn't connected to anything in the layout and only carries the net of
+	// the transistors inside it as an annotation.
+	for (int i = 0; i < (int)tech.subst.size(); i++) {
+		isWell[tech.subst[i].draw] = tech.subst[i].isWell;
+		if (tech.subst[i].pin >= 0 and not tech.subst[i].isWell) {
+			conductor[tech.subst[i].pin] = tech.subst[i].draw;
+		}
+	}
+	set<int> diffusion;
+	for (int m = 0; m < (int)tech.models.size(); m++) {
+		int draw = tech.subst[flip(tech.models[m].stack[0])].draw;
+		conductor[draw] = draw;
+		diffusion.insert(draw);
+	}
+	// Several vias may share a cut layer, so a cut joins the sweeps of every
+	// layer those vias connect.
+	map<int, set<int> > cutOf;
+	for (int v = 0; v < (int)tech.vias.size(); v++) {
+		cutOf[tech.vias[v].draw].insert(levelDraw(tech, tech.vias[v].downLevel));
+		cutOf[tech.vias[v].draw].insert(levelDraw(tech, tech.vias[v].upLevel));
+	}
+
+	// Collect the shapes
+	vector<Rect> rects;
+	vector<int> draws;
+	map<int, vector<int> > byDraw;
+	for (auto layer = geo.layers.begin(); layer != geo.layers.end(); layer++) {
+		for (auto r = layer->geo.begin(); r != layer->geo.end(); r++) {
+			Rect rect = *r;
+			for (int a = 0; a < 2; a++) {
+				if (rect.ll[a] > rect.ur[a]) {
+					swap(rect.ll[a], rect.ur[a]);
+				}
+			}
+			byDraw[layer->draw].push_back((int)rects.size());
+			rects.push_back(rect);
+			draws.push_back(layer->draw);
+		}
+	}
+
+	// Find where poly crosses diffusion. crossings[d] lists the poly
+	// rectangles that cross diffusion rectangle d.
+	vector<pair<int, int> > crossings;
+	for (auto d = diffusion.begin(); d != diffusion.end(); d++) {
+		vector<int> ids = byDraw[*d];
+		ids.insert(ids.end(), byDraw[poly].begin(), byDraw[poly].end());
+		sweepRects(ids, rects, [&](int a, int b) {
+			if (draws[a] == poly and draws[b] != poly) {
+				swap(a, b);
+			}
+			if (draws[a] != poly and draws[b] == poly
+				and rects[a].ll[0] < rects[b].ur[0] and rects[b].ll[0] < rects[a].ur[0]
+				and rects[a].ll[1] < rects[b].ur[1] and rects[b].ll[1] < rects[a].ur[1]) {
+				crossings.push_back(pair<int, int>(a, b));
+			}
+		});
+	}
+	sort(crossings.begin(), crossings.end());
+
+	// Cut the diffusion along the poly so that source and drain aren't
+	// connected through the channel.
+	vector<bool> removed(rects.size(), false);
+	for (auto c = crossings.begin(); c != crossings.end(); ) {
+		int d = c->first;
+		vector<vec2i> cuts;
+		for (; c != crossings.end() and c->first == d; c++) {
+			cuts.push_back(vec2i(rects[c->second].ll[0], rects[c->second].ur[0]));
+		}
+		sort(cuts.begin(), cuts.end(), [](vec2i a, vec2i b) {
+			return a[0] < b[0];
+		});
+
+		Rect rect = rects[d];
+		removed[d] = true;
+		int left = rect.ll[0];
+		for (auto x = cuts.begin(); x != cuts.end(); x++) {
+			if ((*x)[0] > left) {
+				byDraw[draws[d]].push_back((int)rects.size());
+				rects.push_back(Rect(rect.net, vec2i(left, rect.ll[1]), vec2i((*x)[0], rect.ur[1])));
+				draws.push_back(draws[d]);
+				removed.push_back(false);
+			}
+			left = max(left, (*x)[1]);
+		}
+		if (left < rect.ur[0]) {
+			byDraw[draws[d]].push_back((int)rects.size());
+			rects.push_back(Rect(rect.net, vec2i(left, rect.ll[1]), rect.ur));
+			draws.push_back(draws[d]);
+			removed.push_back(false);
+		}
+	}
+
+	// Connect everything that touches
+	vector<int> parent(rects.size(), 0);
+	for (int i = 0; i < (int)parent.size(); i++) {
+		parent[i] = i;
+	}
+	map<int, vector<int> > sweeps;
+	for (auto d = byDraw.begin(); d != byDraw.end(); d++) {
+		auto cond = conductor.find(d->first);
+		auto cut = cutOf.find(d->first);
+		for (auto i = d->second.begin(); i != d->second.end(); i++) {
+			if (removed[*i]) {
+				continue;
+			}
+			if (cond != conductor.end()) {
+				sweeps[cond->second].push_back(*i);
+			} else if (cut != cutOf.end()) {
+				for (auto l = cut->second.begin(); l != cut->second.end(); l++) {
+					sweeps[*l].push_back(*i);
+				}
+			}
+		}
+	}
+	for (auto s = sweeps.begin(); s != sweeps.end(); s++) {
+		sweepRects(s->second, rects, [&](int a, int b) {
+			unite(parent, a, b);
+		});
+	}
+
+	// Merge the crossings into channels. A gate may be drawn with several
+	// overlapping poly and diffusion rectangles, so any crossings on the same
+	// diffusion layer that touch are the same channel.
+	struct Channel {
+		int poly;
+		int diff;
+		Rect rect;
+	};
+	vector<Rect> overlap;
+	map<int, vector<int> > overlapOf;
+	for (auto c = crossings.begin(); c != crossings.end(); c++) {
+		const Rect &d = rects[c->first];
+		const Rect &p = rects[c->second];
+		overlapOf[draws[c->first]].push_back((int)overlap.size());
+		overlap.push_back(Rect(-1, vec2i(max(d.ll[0], p.ll[0]), max(d.ll[1], p.ll[1])), vec2i(min(d.ur[0], p.ur[0]), min(d.ur[1], p.ur[1]))));
+	}
+	vector<int> group(overlap.size(), 0);
+	for (int i = 0; i < (int)group.size(); i++) {
+		group[i] = i;
+	}
+	for (auto d = overlapOf.begin(); d != overlapOf.end(); d++) {
+		sweepRects(d->second, overlap, [&](int a, int b) {
+			unite(group, a, b);
+		});
+	}
+	vector<Channel> channels;
+	map<int, int> channelOf;
+	for (int i = 0; i < (int)overlap.size(); i++) {
+		auto pos = channelOf.insert(pair<int, int>(findRoot(group, i), (int)channels.size()));
+		if (pos.second) {
+			channels.push_back(Channel{crossings[i].second, crossings[i].first, overlap[i]});
+		} else {
+			channels[pos.first->second].rect.bound(overlap[i]);
+		}
+	}
+
+	// Find the substrate layers covering each channel
+	vector<Rect> shapes = rects;
+	vector<vector<int> > covers(channels.size(), vector<int>());
+	{
+		vector<int> ids;
+		for (auto d = byDraw.begin(); d != byDraw.end(); d++) {
+			if (isWell.find(d->first) != isWell.end() and diffusion.find(d->first) == diffusion.end()) {
+				ids.insert(ids.end(), d->second.begin(), d->second.end());
+			}
+		}
+		int base = (int)shapes.size();
+		for (int i = 0; i < (int)channels.size(); i++) {
+			ids.push_back((int)shapes.size());
+			shapes.push_back(channels[i].rect);
+		}
+		sweepRects(ids, shapes, [&](int a, int b) {
+			if (a >= base and b < base) {
+				covers[a-base].push_back(b);
+			} else if (b >= base and a < base) {
+				covers[b-base].push_back(a);
+			}
+		});
+	}
+
+	// Diffusion on either side of each channel
+	map<pair<int, int>, vector<int> > endsAt, startsAt;
+	for (auto d = diffusion.begin(); d != diffusion.end(); d++) {
+		for (auto i = byDraw[*d].begin(); i != byDraw[*d].end(); i++) {
+			if (not removed[*i]) {
+				endsAt[pair<int, int>(*d, rects[*i].ur[0])].push_back(*i);
+				startsAt[pair<int, int>(*d, rects[*i].ll[0])].push_back(*i);
+			}
+		}
+	}
+	auto sideOf = [&](const map<pair<int, int>, vector<int> > &side, int draw, int x, const Rect &ch) {
+		auto pos = side.find(pair<int, int>(draw, x));
+		if (pos != side.end()) {
+			for (auto i = pos->second.begin(); i != pos->second.end(); i++) {
+				if (rects[*i].ll[1] < ch.ur[1] and ch.ll[1] < rects[*i].ur[1]) {
+					return *i;
+				}
+			}
+		}
+		return -1;
+	};
+
+	// Number the nets, naming them after the labels in the layout
+	map<int, int> netOf;
+	map<int, string> names;
+	set<int> ports;
+	// Labels are found with the same sweep as everything else, with each
+	// label as an empty rectangle at its position. The first label on a net
+	// names it.
+	vector<const Label*> labels;
+	map<int, vector<int> > labelsOf;
+	vector<Rect> points = rects;
+	for (auto layer = geo.layers.begin(); layer != geo.layers.end(); layer++) {
+		int draw = -1;
+		for (int i = 0; i < (int)tech.wires.size() and draw < 0; i++) {
+			if (tech.wires[i].label == layer->draw) {
+				draw = tech.wires[i].draw;
+			}
+		}
+		for (int i = 0; i < (int)tech.subst.size() and draw < 0; i++) {
+			if (tech.subst[i].label == layer->draw) {
+				draw = tech.subst[i].draw;
+			}
+		}
+		if (byDraw.find(draw) == byDraw.end()) {
+			continue;
+		}
+		for (auto l = layer->lbl.begin(); l != layer->lbl.end(); l++) {
+			labelsOf[draw].push_back((int)points.size());
+			points.push_back(Rect(-1, l->pos, l->pos));
+			labels.push_back(&*l);
+		}
+	}
+	vector<int> labeled(labels.size(), -1);
+	for (auto d = labelsOf.begin(); d != labelsOf.end(); d++) {
+		vector<int> ids = d->second;
+		for (auto i = byDraw[d->first].begin(); i != byDraw[d->first].end(); i++) {
+			if (not removed[*i]) {
+				ids.push_back(*i);
+			}
+		}
+		int first = (int)rects.size();
+		sweepRects(ids, points, [&](int a, int b) {
+			if (a >= first and b < first) {
+				labeled[a-first] = b;
+			} else if (b >= first and a < first) {
+				labeled[b-first] = a;
+			}
+		});
+	}
+	for (int i = 0; i < (int)labels.size(); i++) {
+		if (labeled[i] >= 0) {
+			names.insert(pair<int, string>(findRoot(parent, labeled[i]), labels[i]->txt));
+		}
+	}
+	for (int i = 0; i < (int)rects.size(); i++) {
+		auto cond = conductor.find(draws[i]);
+		if (not removed[i] and cond != conductor.end() and cond->first != cond->second) {
+			ports.insert(findRoot(parent, i));
+		}
+	}
+
+	auto net = [&](int node) {
+		int root = findRoot(parent, node);
+		auto pos = netOf.find(root);
+		if (pos != netOf.end()) {
+			return pos->second;
+		}
+
+		string name;
+		auto label = names.find(root);
+		if (label != names.end()) {
+			name = label->second;
+		} else if (rects[node].net >= 0 and rects[node].net < (int)geo.nets.size()) {
+			name = geo.nets[rects[node].net].name;
+		} else {
+			name = "_" + to_string(ckt.nets.size());
+		}
 
-	vector<vector<int> > nets;
-	
+		// Two pieces of geometry with the same name that aren't connected are
+		// an open, keep them apart.
+		if (ckt.findNet(name) >= 0) {
+			printf("warning: net %s is open in %s\n", name.c_str(), geo.name.c_str());
+			name += "#" + to_string(ckt.nets.size());
+		}
+
+		int result = ckt.pushNet(name, ports.find(root) != ports.end());
+		netOf.insert(pair<int, int>(root, result));
+		return result;
+	};
+
+	// Recover the transistors. wellOf lists the net that each well is
+	// annotated with, by transistor.
+	vector<pair<int, string> > wellOf;
+	for (int i = 0; i < (int)channels.size(); i++) {
+		const Channel &ch = channels[i];
+		int diff = draws[ch.diff];
+
+		// Pick the model with the most substrate layers that all cover the
+		// channel.
+		set<int> covered;
+		covered.insert(diff);
+		for (auto c = covers[i].begin(); c != covers[i].end(); c++) {
+			covered.insert(draws[*c]);
+		}
+		int model = -1;
+		for (int m = 0; m < (int)tech.models.size(); m++) {
+			bool match = true;
+			for (auto l = tech.models[m].stack.begin(); l != tech.models[m].stack.end() and match; l++) {
+				match = covered.find(tech.subst[flip(*l)].draw) != covered.end();
+			}
+			if (match and tech.subst[flip(tech.models[m].stack[0])].draw == diff
+				and (model < 0 or tech.models[m].stack.size() > tech.models[model].stack.size())) {
+				model = m;
+			}
+		}
+
+		int left = sideOf(endsAt, diff, ch.rect.ll[0], ch.rect);
+		int right = sideOf(startsAt, diff, ch.rect.ur[0], ch.rect);
+		if (model < 0 or left < 0 or right < 0) {
+			printf("warning: unable to extract transistor at (%d,%d) in %s\n", ch.rect.ll[0], ch.rect.ll[1], geo.name.c_str());
+			continue;
+		}
+
+		for (auto c = covers[i].begin(); c != covers[i].end(); c++) {
+			int n = rects[*c].net;
+			if (isWell[draws[*c]] and n >= 0 and n < (int)geo.nets.size()) {
+				wellOf.push_back(pair<int, string>((int)ckt.mos.size(), geo.nets[n].name));
+				break;
+			}
+		}
+
+		int gate = net(ch.poly);
+		int drain = net(left);
+		int source = net(right);
+		vec2i size = ch.rect.ur - ch.rect.ll;
+		ckt.pushMos(tech, model, tech.models[model].type, drain, gate, source, -1, size);
+	}
+
+	// Labeled nets that don't touch a transistor are still part of the
+	// interface
+	for (auto n = names.begin(); n != names.end(); n++) {
+		if (ports.find(n->first) != ports.end()) {
+			net(n->first);
+		}
+	}
+
+	// The base of a transistor is the signal net its well is annotated
+	// with. If no geometry carries that net, then the base is left unset
+	// rather than making a net that only exists in the well.
+	for (auto w = wellOf.begin(); w != wellOf.end(); w++) {
+		ckt.mos[w->first].base = ckt.findNet(w->second);
+	}
+
+	return ckt;
+}
+
+// Nothing in the layout says which side of a transistor is the source, so
+// LVS compares netlists in which every transistor is listed in both
+// directions.
+static Subckt undirected(const Subckt &ckt) {
+	Subckt result(true);
+	result.name = ckt.name;
+	for (auto n = ckt.nets.begin(); n != ckt.nets.end(); n++) {
+		result.pushNet(n->name, n->isIO);
+	}
+	for (auto m = ckt.mos.begin(); m != ckt.mos.end(); m++) {
+		result.pushMos(m->model, m->type, m->drain, m->gate, m->source, m->base);
+		result.mos.back().size = m->size;
+		result.pushMos(m->model, m->type, m->source, m->gate, m->drain, m->base);
+		result.mos.back().size = m->size;
+	}
+	return result;
+}
+
+// The graph that lvs() compares only has the terminals of each transistor,
+// so this collects the rest: its model, its size, and its base. These are
+// grouped by the type and terminals of the transistor, which line up between
+// two netlists under the canonical labeling. The base is left out for a type
+// if withBase is false.
+typedef map<array<int, 4>, vector<array<int, 4> > > DeviceParams;
+
+static DeviceParams deviceParams(const Subckt &ckt, array<bool, 2> withBase) {
+	DeviceParams result;
+	for (auto m = ckt.mos.begin(); m != ckt.mos.end(); m++) {
+		array<int, 4> key = {m->type, m->drain, m->gate, m->source};
+		array<int, 4> param = {m->model, m->size[0], m->size[1], withBase[m->type] ? m->base : -1};
+		result[key].push_back(param);
+	}
+	for (auto d = result.begin(); d != result.end(); d++) {
+		sort(d->second.begin(), d->second.end());
+	}
+	return result;
+}
+
+static void printMos(const Layout &geo, const Subckt &ckt, const char *side, int type, int drain, int gate, int source, int model, vec2i size, int base) {
+	printf("  %s %s %s %s %s %s w=%d l=%d base=%s\n", side, type == Model::NMOS ? "nmos" : "pmos",
+		ckt.nets[drain].name.c_str(), ckt.nets[gate].name.c_str(), ckt.nets[source].name.c_str(),
+		model >= 0 and model < (int)geo.tech->models.size() ? geo.tech->models[model].name.c_str() : "?",
+		size[1], size[0], base >= 0 ? ckt.nets[base].name.c_str() : "-");
+}
+
+// Check the model, size, and base of every transistor once src and ext are
+// known to have the same canonical graph. A transistor type that has no base
+// anywhere in the layout sits in the substrate, which isn't labeled, so its
+// base isn't checked.
+//
+// The canonical labeling doesn't see these parameters, so when the graph has
+// automorphisms it may line up a transistor in src with the image of a
+// different but symmetric transistor in ext. gens holds the automorphisms of
+// the canonical graph. Transistors whose terminals are mapped onto each other
+// by them are interchangeable, so their parameters are compared together as
+// one multiset per orbit.
+static bool matchDevices(const Layout &geo, const Subckt &src, const Subckt &ext, const vector<vector<int> > &gens) {
+	array<bool, 2> withBase = {false, false};
+	for (auto m = ext.mos.begin(); m != ext.mos.end(); m++) {
+		withBase[m->type] = withBase[m->type] or m->base >= 0;
+	}
+
+	array<DeviceParams, 2> params = {deviceParams(src, withBase), deviceParams(ext, withBase)};
+	if (params[0] == params[1]) {
+		return true;
+	}
+
+	map<array<int, 4>, int> index;
+	vector<array<int, 4> > keys;
+	for (int i = 0; i < 2; i++) {
+		for (auto d = params[i].begin(); d != params[i].end(); d++) {
+			if (index.insert(pair<array<int, 4>, int>(d->first, (int)keys.size())).second) {
+				keys.push_back(d->first);
+			}
+		}
+	}
+
+	vector<int> orbit(keys.size());
+	for (int i = 0; i < (int)keys.size(); i++) {
+		orbit[i] = i;
+	}
+	for (auto g = gens.begin(); g != gens.end(); g++) {
+		for (int i = 0; i < (int)keys.size(); i++) {
+			array<int, 4> image = {keys[i][0], (*g)[keys[i][1]], (*g)[keys[i][2]], (*g)[keys[i][3]]};
+			auto j = index.find(image);
+			if (j != index.end()) {
+				unite(orbit, i, j->second);
+			}
+		}
+	}
+
+	map<int, array<vector<array<int, 4> >, 2> > orbits;
+	for (int i = 0; i < (int)keys.size(); i++) {
+		array<vector<array<int, 4> >, 2> &found = orbits[findRoot(orbit, i)];
+		for (int j = 0; j < 2; j++) {
+			auto pos = params[j].find(keys[i]);
+			if (pos != params[j].end()) {
+				found[j].insert(found[j].end(), pos->second.begin(), pos->second.end());
+			}
+		}
+	}
+
+	bool match = true;
+	array<const Subckt*, 2> ckts = {&src, &ext};
+	const char *sides[2] = {"netlist", "layout"};
+	for (auto o = orbits.begin(); o != orbits.end(); o++) {
+		for (int j = 0; j < 2; j++) {
+			sort(o->second[j].begin(), o->second[j].end());
+		}
+		if (o->second[0] == o->second[1]) {
+			continue;
+		}
+
+		if (match) {
+			printf("error: lvs %s: transistors don't match\n", src.name.c_str());
+			match = false;
+		}
+		for (int i = 0; i < (int)keys.size(); i++) {
+			const array<int, 4> &k = keys[i];
+			// undirected() lists every transistor both ways, so only report one
+			if (findRoot(orbit, i) != o->first or k[1] > k[3]) {
+				continue;
+			}
+			for (int j = 0; j < 2; j++) {
+				auto pos = params[j].find(k);
+				if (pos == params[j].end()) {
+					continue;
+				}
+				for (auto p = pos->second.begin(); p != pos->second.end(); p++) {
+					printMos(geo, *ckts[j], sides[j], k[0], k[1], k[2], k[3], (*p)[0], vec2i((*p)[1], (*p)[2]), (*p)[3]);
+				}
+			}
+		}
+	}
+	return match;
+}
+
+static vector<string> portNames(const Subckt &ckt) {
+	vector<string> result;
+	for (auto n = ckt.nets.begin(); n != ckt.nets.end(); n++) {
+		if (n->isIO) {
+			result.push_back(n->name);
+		}
+	}
+	sort(result.begin(), result.end());
+	return result;
+}
+
+// Give each port its own color by the rank of its name in ports, so that a
+// port can only be mapped onto the port with the same name.
+static void colorPorts(Adjacency &adj, const Subckt &ckt, const vector<string> &ports) {
+	for (int i = 0; i < (int)ckt.nets.size(); i++) {
+		if (ckt.nets[i].isIO) {
+			adj.netColor[i] = 1 + (int)(lower_bound(ports.begin(), ports.end(), ckt.nets[i].name) - ports.begin());
+		}
+	}
+}
+
+// If gens is not null, it is filled with the automorphisms of the colored
+// graph, given in terms of the canonical net indices.
+static void canonicalize(Subckt &ckt, const vector<string> &ports, vector<vector<int> > *gens=nullptr) {
+	Adjacency adj(ckt);
+	colorPorts(adj, ckt, ports);
+	vector<int> lbl = canonicalLabels(adj, gens);
+	ckt.apply(Mapping(lbl));
+	sort(ckt.ports.begin(), ckt.ports.end());
+	ckt.id = std::hash<Subckt>{}(ckt);
+
+	if (gens != nullptr) {
+		// lbl[i] is the old index of canonical net i
+		vector<int> inv(lbl.size(), -1);
+		for (int i = 0; i < (int)lbl.size(); i++) {
+			inv[lbl[i]] = i;
+		}
+		vector<int> image(lbl.size(), -1);
+		for (auto g = gens->begin(); g != gens->end(); g++) {
+			for (int i = 0; i < (int)lbl.size(); i++) {
+				image[i] = inv[(*g)[lbl[i]]];
+			}
+			std::swap(*g, image);
+		}
+	}
+}
+
+// Most cells match, so the fast path is to canonicalize both netlists and
+// compare their hashes, then their structure. Each port is colored by its name,
+// so the canonical labeling of both can only line up ports with the same name.
+// Once the graphs match, matchDevices() checks what the graph doesn't show
+// about each transistor. When the graphs differ, both netlists are put side by
+// side in one graph and refined into an equitable partition. A net in a cell
+// that doesn't hold the same number of nets from each side has no counterpart
+// in the other netlist, and neither does a transistor whose terminals are in
+// such cells.
+bool lvs(const Layout &geo, const Subckt &ckt) {
+	Subckt src = undirected(ckt);
+	Subckt ext = undirected(extract(geo));
+
+	vector<string> srcPorts = portNames(src);
+	vector<string> extPorts = portNames(ext);
+	if (srcPorts != extPorts) {
+		printf("error: lvs %s: ports don't match\n", ckt.name.c_str());
+		printf("  netlist:");
+		for (auto p = srcPorts.begin(); p != srcPorts.end(); p++) {
+			printf(" %s", p->c_str());
+		}
+		printf("\n  layout:");
+		for (auto p = extPorts.begin(); p != extPorts.end(); p++) {
+			printf(" %s", p->c_str());
+		}
+		printf("\n");
+		return false;
+	}
+
+	vector<vector<int> > gens;
+	canonicalize(src, srcPorts, &gens);
+	canonicalize(ext, srcPorts);
+	if (src.id == ext.id and src.compare(ext) == 0) {
+		bool match = true;
+		for (int i = 0; i < (int)src.nets.size() and match; i++) {
+			match = src.nets[i].isIO == ext.nets[i].isIO
+				and (not src.nets[i].isIO or src.nets[i].name == ext.nets[i].name);
+		}
+		if (match) {
+			return matchDevices(geo, src, ext, gens);
+		}
+	}
+
+	// Put both netlists into one graph
+	Subckt both(true);
+	int split = (int)src.nets.size();
+	for (auto n = src.nets.begin(); n != src.nets.end(); n++) {
+		both.pushNet(n->name, n->isIO);
+	}
+	for (auto n = ext.nets.begin(); n != ext.nets.end(); n++) {
+		both.pushNet(n->name, n->isIO);
+	}
+	for (auto m = src.mos.begin(); m != src.mos.end(); m++) {
+		both.pushMos(m->model, m->type, m->drain, m->gate, m->source, m->base);
+		both.mos.back().size = m->size;
+	}
+	for (auto m = ext.mos.begin(); m != ext.mos.end(); m++) {
+		both.pushMos(m->model, m->type, m->drain+split, m->gate+split, m->source+split, m->base < 0 ? -1 : m->base+split);
+		both.mos.back().size = m->size;
+	}
+
+	Adjacency adj(both);
+	colorPorts(adj, both, srcPorts);
+	Partition part(adj.verts());
+	part.color(adj);
+	vector<int> alpha;
+	for (int i = 0; i < (int)part.lab.size(); i += part.length[i]) {
+		alpha.push_back(i);
+	}
+	part.refine(adj, alpha);
+
+	printf("error: lvs %s: layout doesn't match netlist\n", ckt.name.c_str());
+	vector<bool> bad(both.nets.size(), false);
+	for (int i = 0; i < (int)part.lab.size(); i += part.length[i]) {
+		int fromSrc = 0;
+		for (int j = i; j < i+part.length[i]; j++) {
+			fromSrc += part.lab[j] < split ? 1 : 0;
+		}
+		if (fromSrc*2 != part.length[i]) {
+			for (int j = i; j < i+part.length[i]; j++) {
+				int n = part.lab[j];
+				bad[n] = true;
+				printf("  %s net %s\n", n < split ? "netlist" : "layout", both.nets[n].name.c_str());
+			}
+		}
+	}
+
+	// Refinement can't tell apart some graphs that aren't isomorphic, like
+	// two regular graphs of the same degree.
+	if (find(bad.begin(), bad.end(), true) == bad.end()) {
+		printf("  no local difference found\n");
+		return false;
+	}
+
+	// Each transistor was listed twice by undirected(), so only report the
+	// first of each pair.
+	for (int i = 0; i < (int)both.mos.size(); i += 2) {
+		const Mos &m = both.mos[i];
+		if (bad[m.gate] or bad[m.source] or bad[m.drain]) {
+			printMos(geo, both, m.gate < split ? "netlist" : "layout", m.type, m.drain, m.gate, m.source, m.model, m.size, m.base);
+		}
+	}
+	return false;
 }
 
 }
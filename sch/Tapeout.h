@@ -1,11 +1,26 @@
 #pragma once
 
 #include "Netlist.h"
+#include "Cache.h"
 #include <phy/Library.h>
 
 namespace sch {
 
-int routeCell(phy::Library &lib, Netlist &lst, int idx, bool progress=false, bool debug=false);
+// The router's spacing checks go through spacing if it isn't null, see
+// SpacingCache. Otherwise, the router uses its own. The router is seeded with
+// idx, so a cell routes the same way no matter what else is running.
+int routeCell(phy::Library &lib, Netlist &lst, int idx, bool progress=false, bool debug=false, const CellCache *cache=nullptr, SpacingCache *spacing=nullptr);
+
+// Place and route every subckt in lst into the matching entry of lib.macros,
+// growing lib.macros if needed. This runs routeCell() on a pool of threads
+// (see threadCount()) and returns its status for each subckt. The cells share
+// one SpacingCache.
+vector<int> routeLibrary(phy::Library &lib, Netlist &lst, bool progress=false, bool debug=false, const CellCache *cache=nullptr, int threads=1);
 Subckt extract(const Layout &geo);
 
+// Check the layout of a cell against its netlist, including the model, size,
+// and base of each transistor. Returns true if they match. Otherwise, the nets
+// and transistors that don't match are printed.
+bool lvs(const Layout &geo, const Subckt &ckt);
+
 }
@@ -3,7 +3,7 @@
 namespace sch {
 
 void bitset::set(int i, bool v) {
-	int idx = ((i+63)/64);
+	int idx = i/64;
 	int bit = i%64;
 	if (idx >= (int)data.size()) {
 		if (not v) {
@@ -13,14 +13,14 @@ void bitset::set(int i, bool v) {
 	}
 
 	if (v) {
-		data[idx] |= (1<<bit);
+		data[idx] |= ((uint64_t)1<<bit);
 	} else {
-		data[idx] &= ~(1<<bit);
+		data[idx] &= ~((uint64_t)1<<bit);
 	}
 }
 
 bool bitset::get(int i) const {
-	int idx = ((i+63)/64);
+	int idx = i/64;
 	int bit = i%64;
 	if (idx >= (int)data.size()) {
 		return false;
@@ -65,5 +65,115 @@ bool bitset::empty() const {
 	return true;
 }
 
+int bitset::count() const {
+	int result = 0;
+	for (auto i = data.begin(); i != data.end(); i++) {
+		result += __builtin_popcountll(*i);
+	}
+	return result;
+}
+
+int bitset::next(int i) const {
+	if (i < 0) {
+		i = 0;
+	}
+	int idx = i/64;
+	if (idx >= (int)data.size()) {
+		return -1;
+	}
+
+	// mask off the bits before i in the first word
+	uint64_t word = data[idx] & (~(uint64_t)0 << (i%64));
+	while (word == 0) {
+		if (++idx >= (int)data.size()) {
+			return -1;
+		}
+		word = data[idx];
+	}
+	return idx*64 + __builtin_ctzll(word);
+}
+
+bitmatrix::bitmatrix() {
+	n = 0;
+	stride = 0;
+}
+
+bitmatrix::bitmatrix(int n) {
+	this->n = n;
+	this->stride = (n+63)/64;
+	this->data.resize((size_t)n*stride, 0);
+}
+
+bitmatrix::~bitmatrix() {
+}
+
+void bitmatrix::set(int i, int j, bool v) {
+	uint64_t &word = data[(size_t)i*stride + j/64];
+	if (v) {
+		word |= ((uint64_t)1<<(j%64));
+	} else {
+		word &= ~((uint64_t)1<<(j%64));
+	}
 }
 
+bool bitmatrix::get(int i, int j) const {
+	return (data[(size_t)i*stride + j/64]>>(j%64))&1;
+}
+
+void bitmatrix::merge(int i, int j) {
+	uint64_t *dst = data.data() + (size_t)i*stride;
+	const uint64_t *src = data.data() + (size_t)j*stride;
+	for (int w = 0; w < stride; w++) {
+		dst[w] |= src[w];
+	}
+}
+
+int bitmatrix::count(int i) const {
+	int result = 0;
+	const uint64_t *row = data.data() + (size_t)i*stride;
+	for (int w = 0; w < stride; w++) {
+		result += __builtin_popcountll(row[w]);
+	}
+	return result;
+}
+
+int bitmatrix::next(int i, int j) const {
+	if (j < 0) {
+		j = 0;
+	}
+	if (j >= n) {
+		return -1;
+	}
+
+	const uint64_t *row = data.data() + (size_t)i*stride;
+	int w = j/64;
+	uint64_t word = row[w] & (~(uint64_t)0 << (j%64));
+	while (word == 0) {
+		if (++w >= stride) {
+			return -1;
+		}
+		word = row[w];
+	}
+	return w*64 + __builtin_ctzll(word);
+}
+
+void bitmatrix::closure() {
+	// For each intermediate k, every row that reaches k also reaches everything
+	// k reaches. Column k is tested one bit per row, but the row update is a
+	// straight run of word-wide ORs that the compiler can vectorize.
+	for (int k = 0; k < n; k++) {
+		const uint64_t *src = data.data() + (size_t)k*stride;
+		int kw = k/64;
+		uint64_t kbit = (uint64_t)1<<(k%64);
+		for (int i = 0; i < n; i++) {
+			uint64_t *dst = data.data() + (size_t)i*stride;
+			if (i != k and (dst[kw] & kbit)) {
+				for (int w = 0; w < stride; w++) {
+					dst[w] |= src[w];
+				}
+			}
+		}
+	}
+}
+
+}
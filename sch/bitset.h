@@ -7,6 +7,8 @@ using namespace std;
 
 namespace sch {
 
+// A dense, dynamically sized set of bits. Bit i lives in word i/64. Missing
+// words are treated as zero, so a bitset grows as bits are set.
 struct bitset {
 	vector<uint64_t> data;
 
@@ -18,7 +20,39 @@ struct bitset {
 	bitset &operator&=(const bitset &b);
 
 	bool empty() const;
+	// the number of set bits
+	int count() const;
+	// the index of the first set bit at or after i, or -1 if there isn't one.
+	// for (int i = b.next(0); i >= 0; i = b.next(i+1))
+	int next(int i) const;
 };
 
-}
+// A square matrix of bits stored as one flat array of rows, each row padded
+// out to a whole number of words. Row operations work a word at a time.
+struct bitmatrix {
+	bitmatrix();
+	bitmatrix(int n);
+	~bitmatrix();
+
+	int n;
+	// number of words per row
+	int stride;
+	vector<uint64_t> data;
+
+	void set(int i, int j, bool v);
+	bool get(int i, int j) const;
 
+	// row i |= row j
+	void merge(int i, int j);
+	// the number of set bits in row i
+	int count(int i) const;
+	// the index of the first set bit in row i at or after j, or -1
+	int next(int i, int j) const;
+
+	// Replace this relation with its transitive closure using Warshall's
+	// algorithm. After this, get(i, j) is true if there is any path of set
+	// bits from i to j.
+	void closure();
+};
+
+}
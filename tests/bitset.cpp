@@ -0,0 +1,57 @@
+#include <gtest/gtest.h>
+
+#include <sch/bitset.h>
+
+using namespace sch;
+using namespace std;
+
+TEST(bitset, words)
+{
+	bitset b;
+	int bits[] = {0, 31, 32, 63, 64, 65, 127, 200};
+	for (int i = 0; i < 8; i++) {
+		b.set(bits[i], true);
+	}
+
+	EXPECT_EQ(b.count(), 8);
+	for (int i = 0; i < 256; i++) {
+		bool expect = false;
+		for (int j = 0; j < 8; j++) {
+			expect = expect or bits[j] == i;
+		}
+		EXPECT_EQ(b.get(i), expect) << "bit " << i;
+	}
+
+	int k = 0;
+	for (int i = b.next(0); i >= 0; i = b.next(i+1)) {
+		ASSERT_LT(k, 8);
+		EXPECT_EQ(i, bits[k++]);
+	}
+	EXPECT_EQ(k, 8);
+
+	b.set(64, false);
+	EXPECT_FALSE(b.get(64));
+	EXPECT_TRUE(b.get(63));
+	EXPECT_TRUE(b.get(65));
+	EXPECT_EQ(b.count(), 7);
+}
+
+TEST(bitset, closure)
+{
+	// A chain 0 -> 1 -> ... -> 99 given in reverse order, which a single pass
+	// in index order can't close.
+	int n = 100;
+	bitmatrix m(n);
+	for (int i = n-1; i > 0; i--) {
+		m.set(i, i-1, true);
+	}
+	m.closure();
+
+	for (int i = 0; i < n; i++) {
+		EXPECT_EQ(m.count(i), i);
+		for (int j = 0; j < n; j++) {
+			EXPECT_EQ(m.get(i, j), j < i);
+		}
+		EXPECT_EQ(m.next(i, 0), i > 0 ? 0 : -1);
+	}
+}
@@ -0,0 +1,126 @@
+#include <gtest/gtest.h>
+
+#include <sch/Cache.h>
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+using namespace sch;
+using namespace std;
+
+// Create an inverter and canonicalize it so that it has a cache key
+static Subckt buildInverter() {
+	Subckt ckt;
+	ckt.name = "inv";
+	int gnd = ckt.pushNet("GND", true);
+	int vdd = ckt.pushNet("Vdd", true);
+	int a = ckt.pushNet("a", true);
+	int y = ckt.pushNet("y", true);
+	ckt.pushMos(-1, Model::NMOS, y, a, gnd);
+	ckt.pushMos(-1, Model::PMOS, y, a, vdd);
+	ckt.canonicalize();
+	return ckt;
+}
+
+static Layout buildLayout(const Tech &tech) {
+	Layout geo(tech);
+	geo.box = Rect(-1, vec2i(0, 0), vec2i(20, 40));
+	geo.push(0, Rect(2, vec2i(4, 0), vec2i(6, 40)));
+	geo.push(1, Rect(0, vec2i(0, 0), vec2i(20, 4)));
+	geo.push(1, Rect(3, vec2i(8, 10), vec2i(12, 30)));
+	return geo;
+}
+
+static string readFile(string path) {
+	ifstream fin(path);
+	stringstream buf;
+	buf << fin.rdbuf();
+	return buf.str();
+}
+
+// An empty cache directory for one test
+static string cacheDir(string test) {
+	string dir = (filesystem::temp_directory_path() / ("sch_cache_" + test + "_" + to_string(getpid()))).string();
+	filesystem::remove_all(dir);
+	return dir;
+}
+
+TEST(cache, round_trip)
+{
+	string dir = cacheDir("round_trip");
+	Tech tech;
+	Subckt ckt = buildInverter();
+	Layout src = buildLayout(tech);
+	Placement pl = Placement::solve(ckt);
+	CellCache cache(dir);
+	ASSERT_TRUE(cache.save(src, ckt, pl, 3));
+
+	Subckt loaded = buildInverter();
+	Layout dst(tech);
+	int status = -1;
+	array<vector<Device>, 2> stack;
+	ASSERT_TRUE(cache.load(dst, loaded, &status, &stack));
+	EXPECT_EQ(status, 3);
+
+	for (int type = 0; type < 2; type++) {
+		ASSERT_EQ(stack[type].size(), pl.stack[type].size());
+		for (int i = 0; i < (int)stack[type].size(); i++) {
+			EXPECT_EQ(stack[type][i].device, pl.stack[type][i].device);
+			EXPECT_EQ(stack[type][i].flip, pl.stack[type][i].flip);
+		}
+	}
+
+	EXPECT_EQ(dst.box.ll, src.box.ll);
+	EXPECT_EQ(dst.box.ur, src.box.ur);
+	for (auto layer = src.layers.begin(); layer != src.layers.end(); layer++) {
+		auto other = dst.find(layer->draw);
+		ASSERT_TRUE(other != dst.layers.end());
+		ASSERT_EQ(other->geo.size(), layer->geo.size());
+		for (int i = 0; i < (int)layer->geo.size(); i++) {
+			EXPECT_EQ(other->geo[i].net, layer->geo[i].net);
+			EXPECT_EQ(other->geo[i].ll, layer->geo[i].ll);
+			EXPECT_EQ(other->geo[i].ur, layer->geo[i].ur);
+		}
+	}
+	filesystem::remove_all(dir);
+}
+
+TEST(cache, version_mismatch)
+{
+	string dir = cacheDir("version_mismatch");
+	Tech tech;
+	Subckt ckt = buildInverter();
+	CellCache cache(dir);
+	ASSERT_TRUE(cache.save(buildLayout(tech), ckt, Placement::solve(ckt), 0));
+
+	// Entries start with "cell <version> <id>"
+	string content = readFile(cache.path(ckt));
+	size_t first = content.find(' ');
+	size_t second = content.find(' ', first+1);
+	ASSERT_NE(second, string::npos);
+	int version = stoi(content.substr(first+1, second-first-1));
+	content.replace(first+1, second-first-1, to_string(version+1));
+	ofstream(cache.path(ckt)) << content;
+
+	Layout dst(tech);
+	EXPECT_FALSE(cache.load(dst, ckt));
+	filesystem::remove_all(dir);
+}
+
+TEST(cache, truncated)
+{
+	string dir = cacheDir("truncated");
+	Tech tech;
+	Subckt ckt = buildInverter();
+	CellCache cache(dir);
+	ASSERT_TRUE(cache.save(buildLayout(tech), ckt, Placement::solve(ckt), 0));
+
+	string path = cache.path(ckt);
+	filesystem::resize_file(path, filesystem::file_size(path)/2);
+
+	Layout dst(tech);
+	EXPECT_FALSE(cache.load(dst, ckt));
+	filesystem::remove_all(dir);
+}
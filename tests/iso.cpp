@@ -1,13 +1,16 @@
 #include <gtest/gtest.h>
 
 #include <sch/Placer.h>
+#include <sch/Adjacency.h>
 #include <random>
 #include <algorithm>
+#include <array>
+#include <set>
 
 using namespace sch;
 using namespace std;
 
-Subckt genRand(int n, bool dev=false) {
+Subckt genRand(int n, bool dev=false, unsigned seed=0) {
 	Subckt ckt;
 	ckt.name = "test";
 
@@ -17,7 +20,7 @@ Subckt genRand(int n, bool dev=false) {
 		nets[i] = ckt.pushNet("n" + to_string(i));
 	}
 
-	std::default_random_engine rand(0/*std::random_device{}()*/);
+	std::default_random_engine rand(seed);
 	shuffle(nets.begin(), nets.end(), rand);
 
 	// Create a highly symmetric graph for testing. Every permutation of this
@@ -40,15 +43,15 @@ Subckt genRand(int n, bool dev=false) {
 TEST(iso, canonical_equal)
 {
 	int n = 5;
-	Subckt ckt = genRand(n);
-	auto canon = Mapping(ckt).remap(canonicalLabels(ckt)).generate(ckt, "cell");
+	Subckt canon = genRand(n);
+	canon.canonicalize();
 
 	int equal = 0;
 	int count = 100;
 	for (int i = 0; i < count; i++) {
-		Subckt test = genRand(n);
-		auto canon2 = Mapping(test).remap(canonicalLabels(test)).generate(test, "cell");
-		int cmp = canon.compare(canon2);
+		Subckt test = genRand(n, false, i+1);
+		test.canonicalize();
+		int cmp = canon.compare(test);
 		equal += (cmp == 0);
 	}
 
@@ -58,18 +61,41 @@ TEST(iso, canonical_equal)
 TEST(iso, canonical_not_equal)
 {
 	int n = 5;
-	Subckt ckt = genRand(n);
-	auto canon = Mapping(ckt).remap(canonicalLabels(ckt)).generate(ckt, "cell");
+	Subckt canon = genRand(n);
+	canon.canonicalize();
 
 	int equal = 0;
 	int count = 100;
 	for (int i = 0; i < count; i++) {
-		Subckt test = genRand(n, true);
-		auto canon2 = Mapping(test).remap(canonicalLabels(test)).generate(test, "cell");
-		int cmp = canon.compare(canon2);
+		Subckt test = genRand(n, true, i+1);
+		test.canonicalize();
+		int cmp = canon.compare(test);
 		equal += (cmp == 0);
 	}
 
 	EXPECT_EQ(equal, 0);
 }
 
+
+TEST(iso, automorphisms)
+{
+	int n = 5;
+	Subckt ckt = genRand(n, false, 1);
+
+	vector<vector<int> > gens;
+	canonicalLabels(Adjacency(ckt), &gens);
+	EXPECT_FALSE(gens.empty());
+
+	// Every automorphism maps the transistors onto themselves
+	multiset<array<int, 3> > devs;
+	for (auto m = ckt.mos.begin(); m != ckt.mos.end(); m++) {
+		devs.insert(array<int, 3>{m->drain, m->gate, m->source});
+	}
+	for (auto g = gens.begin(); g != gens.end(); g++) {
+		multiset<array<int, 3> > image;
+		for (auto m = ckt.mos.begin(); m != ckt.mos.end(); m++) {
+			image.insert(array<int, 3>{(*g)[m->drain], (*g)[m->gate], (*g)[m->source]});
+		}
+		EXPECT_EQ(image, devs);
+	}
+}
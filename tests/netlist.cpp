@@ -0,0 +1,117 @@
+#include <gtest/gtest.h>
+
+#include <sch/Netlist.h>
+
+#include <algorithm>
+#include <map>
+
+using namespace sch;
+using namespace std;
+
+static void buildNetlist(Netlist &lst) {
+	// Create a nand gate followed by an inverter, with its ports listed in an
+	// order that canonicalization is unlikely to keep
+	Subckt cell(true);
+	cell.name = "cell";
+	int y = cell.pushNet("y", true);
+	int b = cell.pushNet("b", true);
+	int vdd = cell.pushNet("Vdd", true);
+	int a = cell.pushNet("a", true);
+	int gnd = cell.pushNet("GND", true);
+	int x = cell.pushNet("x");
+	int m = cell.pushNet("m");
+	cell.pushMos(-1, Model::NMOS, x, a, m);
+	cell.pushMos(-1, Model::NMOS, m, b, gnd);
+	cell.pushMos(-1, Model::PMOS, x, a, vdd);
+	cell.pushMos(-1, Model::PMOS, x, b, vdd);
+	cell.pushMos(-1, Model::NMOS, y, x, gnd);
+	cell.pushMos(-1, Model::PMOS, y, x, vdd);
+	lst.subckts.push_back(cell);
+
+	// Wire an instance of it up positionally with nets of the same name
+	Subckt top;
+	top.name = "top";
+	Instance inst;
+	inst.subckt = 0;
+	for (auto p = cell.ports.begin(); p != cell.ports.end(); p++) {
+		inst.ports.push_back(top.pushNet(cell.nets[*p].name, true));
+	}
+	top.pushInst(inst);
+	lst.subckts.push_back(top);
+}
+
+TEST(netlist, instance_ports)
+{
+	for (int threads = 1; threads <= 4; threads += 3) {
+		Tech tech;
+		Netlist lst(tech);
+		buildNetlist(lst);
+		lst.mapCells(false, threads);
+
+		// Canonicalizing the cell renumbers its nets, but it must keep the order
+		// of its ports, and every instance must still connect each port to the
+		// same net
+		const Subckt &cell = lst.subckts[0];
+		const Subckt &top = lst.subckts[1];
+		const char *names[5] = {"y", "b", "Vdd", "a", "GND"};
+		ASSERT_EQ(cell.ports.size(), 5u);
+		for (int k = 0; k < 5; k++) {
+			EXPECT_EQ(cell.nets[cell.ports[k]].name, names[k]);
+		}
+		ASSERT_EQ(top.inst.size(), 1u);
+		ASSERT_EQ(top.inst[0].ports.size(), cell.ports.size());
+		for (int k = 0; k < (int)cell.ports.size(); k++) {
+			EXPECT_EQ(top.nets[top.inst[0].ports[k]].name, cell.nets[cell.ports[k]].name);
+		}
+	}
+}
+
+// The role of a net in an inverter: 0 for the input, 1 for the output, 2 for
+// GND, and 3 for Vdd
+static int role(const Net &net) {
+	if (not net.gateOf[0].empty() or not net.gateOf[1].empty()) {
+		return 0;
+	} else if (not net.drainOf[0].empty() or not net.drainOf[1].empty()) {
+		return 1;
+	}
+	return net.sourceOf[0].empty() ? 3 : 2;
+}
+
+TEST(netlist, generated_ports)
+{
+	for (int threads = 1; threads <= 4; threads += 3) {
+		// Two inverters whose nets are found in different orders, so the
+		// cells generated from them list their ports in different orders
+		// before they are deduplicated
+		Tech tech;
+		Netlist lst(tech);
+		Subckt top;
+		top.name = "top";
+		int gnd = top.pushNet("GND", true);
+		int vdd = top.pushNet("Vdd", true);
+		int a = top.pushNet("a", true);
+		int z = top.pushNet("z", true);
+		int y = top.pushNet("y", true);
+		top.pushMos(-1, Model::NMOS, y, a, gnd, gnd);
+		top.pushMos(-1, Model::PMOS, y, a, vdd, vdd);
+		top.pushMos(-1, Model::PMOS, z, y, vdd, vdd);
+		top.pushMos(-1, Model::NMOS, z, y, gnd, gnd);
+		lst.subckts.push_back(top);
+		lst.mapCells(false, threads);
+
+		// Every instance must connect each port to a net with the same role
+		const Subckt &result = lst.subckts[0];
+		map<string, vector<int> > expect = {
+			{"a", {0}}, {"y", {0, 1}}, {"z", {1}}, {"GND", {2}}, {"Vdd", {3}}
+		};
+		ASSERT_EQ(result.inst.size(), 2u);
+		for (auto i = result.inst.begin(); i != result.inst.end(); i++) {
+			const Subckt &cell = lst.subckts[i->subckt];
+			ASSERT_EQ(i->ports.size(), cell.ports.size());
+			for (int k = 0; k < (int)cell.ports.size(); k++) {
+				const vector<int> &roles = expect[result.nets[i->ports[k]].name];
+				EXPECT_NE(find(roles.begin(), roles.end(), role(cell.nets[cell.ports[k]])), roles.end());
+			}
+		}
+	}
+}
@@ -5,6 +5,26 @@
 using namespace sch;
 using namespace std;
 
+// Create a nand gate followed by an inverter
+static Subckt buildNandInv() {
+	Subckt ckt;
+	ckt.name = "test";
+	int gnd = ckt.pushNet("GND", true);
+	int vdd = ckt.pushNet("Vdd", true);
+	int a = ckt.pushNet("a", true);
+	int b = ckt.pushNet("b", true);
+	int y = ckt.pushNet("y", true);
+	int x = ckt.pushNet("x");
+	int m = ckt.pushNet("m");
+	ckt.pushMos(-1, Model::NMOS, x, a, m);
+	ckt.pushMos(-1, Model::NMOS, m, b, gnd);
+	ckt.pushMos(-1, Model::PMOS, x, a, vdd);
+	ckt.pushMos(-1, Model::PMOS, x, b, vdd);
+	ckt.pushMos(-1, Model::NMOS, y, x, gnd);
+	ckt.pushMos(-1, Model::PMOS, y, x, vdd);
+	return ckt;
+}
+
 TEST(placer, solve)
 {
 	Subckt ckt;
@@ -22,3 +42,149 @@ TEST(placer, solve)
 }
 
 
+TEST(placer, incremental)
+{
+	Subckt ckt = buildNandInv();
+
+	std::default_random_engine rand(0);
+	Placement pl(ckt, 12, 1, 1, 10, rand);
+	int size = (int)pl.stack[0].size();
+	for (int iter = 0; iter < 200; iter++) {
+		int i = (int)(rand()%3);
+		int j = (int)(rand()%size);
+		int k = (int)(rand()%size);
+		if (j == k) {
+			continue;
+		}
+		vec4i choice(i == 2 ? 0 : i, i == 2 ? 2 : i+1, min(j, k), max(j, k));
+
+		// The score of the move must match the score of the placement
+		// recomputed from scratch after making the move.
+		int expect = pl.score(choice);
+		pl.move(choice);
+		EXPECT_EQ(pl.score(), expect);
+		Placement check(pl);
+		check.update();
+		EXPECT_EQ(check.score(), expect);
+	}
+}
+
+TEST(placer, threads)
+{
+	Subckt ckt;
+	ckt.name = "test";
+	// The nmos and pmos gates are on different nets, so the first pair of
+	// gates can never line up. That keeps solve() from returning early after
+	// the first descent, and the exact search is turned off so that the
+	// restarts are run.
+	int gnd = ckt.pushNet("GND", true);
+	int vdd = ckt.pushNet("Vdd", true);
+	int y = ckt.pushNet("y", true);
+	int n[4], p[4];
+	for (int i = 0; i < 4; i++) {
+		n[i] = ckt.pushNet(string(1, 'a'+i), true);
+		p[i] = ckt.pushNet(string(1, 'e'+i), true);
+	}
+	int n0 = ckt.pushNet("n0");
+	int n1 = ckt.pushNet("n1");
+	int p0 = ckt.pushNet("p0");
+	ckt.pushMos(-1, Model::NMOS, y, n[0], n0);
+	ckt.pushMos(-1, Model::NMOS, n0, n[1], gnd);
+	ckt.pushMos(-1, Model::NMOS, y, n[2], n1);
+	ckt.pushMos(-1, Model::NMOS, n1, n[3], gnd);
+	ckt.pushMos(-1, Model::PMOS, y, p[0], p0);
+	ckt.pushMos(-1, Model::PMOS, p0, p[1], vdd);
+	ckt.pushMos(-1, Model::PMOS, y, p[2], vdd);
+	ckt.pushMos(-1, Model::PMOS, p0, p[3], vdd);
+
+	// The result must not depend upon the number of threads
+	Placement serial = Placement::solve(ckt, 20, 12, 1, 1, 10, 2.0, 0.02, 1, 0, 0);
+	Placement parallel = Placement::solve(ckt, 20, 12, 1, 1, 10, 2.0, 0.02, 4, 0, 0);
+	EXPECT_GT(serial.G, 0);
+	EXPECT_EQ(serial.score(), parallel.score());
+	for (int type = 0; type < 2; type++) {
+		ASSERT_EQ(serial.stack[type].size(), parallel.stack[type].size());
+		for (int i = 0; i < (int)serial.stack[type].size(); i++) {
+			EXPECT_EQ(serial.stack[type][i].device, parallel.stack[type][i].device);
+			EXPECT_EQ(serial.stack[type][i].flip, parallel.stack[type][i].flip);
+		}
+	}
+}
+
+TEST(placer, euler)
+{
+	Subckt ckt = buildNandInv();
+
+	// Both diffusion graphs have an Euler path, so no trail should ever need
+	// a break.
+	std::default_random_engine rand(0);
+	for (int iter = 0; iter < 20; iter++) {
+		Placement pl(ckt, 12, 1, 1, 10, rand);
+		pl.euler(rand);
+		EXPECT_EQ(pl.brk[0], 0);
+		EXPECT_EQ(pl.brk[1], 0);
+		EXPECT_EQ(pl.stack[0].size(), 3u);
+		EXPECT_EQ(pl.stack[1].size(), 3u);
+	}
+}
+
+TEST(placer, exact)
+{
+	Subckt ckt = buildNandInv();
+
+	// The exact search must do at least as well as annealing no matter where
+	// it starts
+	Placement annealed = Placement::solve(ckt, 20, 12, 1, 1, 10, 2.0, 0.02, 1, 0, 0);
+	std::default_random_engine rand(0);
+	for (int iter = 0; iter < 5; iter++) {
+		Placement start(ckt, 12, 1, 1, 10, rand);
+		Placement result = Placement::exact(start);
+		EXPECT_LE(result.score(), annealed.score());
+		EXPECT_LE(result.score(), start.score());
+		EXPECT_EQ(result.brk[0], 0);
+		EXPECT_EQ(result.brk[1], 0);
+		EXPECT_EQ(result.G, 0);
+	}
+	EXPECT_EQ(Placement::solve(ckt).score(), Placement::exact(annealed).score());
+}
+
+TEST(placer, exact_breaks)
+{
+	Subckt ckt;
+	ckt.name = "test";
+	// The nmos stack of this cell needs a diffusion break and the pmos stack
+	// doesn't, so W goes negative for some placements
+	int n0 = ckt.pushNet("n0", true);
+	int n1 = ckt.pushNet("n1", true);
+	int n2 = ckt.pushNet("n2");
+	int n3 = ckt.pushNet("n3");
+	int n4 = ckt.pushNet("n4");
+	ckt.pushMos(-1, Model::NMOS, n1, n4, n1);
+	ckt.pushMos(-1, Model::NMOS, n0, n0, n2);
+	ckt.pushMos(-1, Model::PMOS, n1, n2, n4);
+	ckt.pushMos(-1, Model::PMOS, n3, n1, n2);
+	ckt.pushMos(-1, Model::PMOS, n4, n1, n4);
+
+	std::default_random_engine rand(0);
+	for (int iter = 0; iter < 100; iter++) {
+		Placement start(ckt, 1, 1, 26, 10, rand);
+		EXPECT_LE(Placement::exact(start).score(), start.score());
+	}
+}
+
+TEST(placer, exact_budget)
+{
+	Subckt ckt = buildNandInv();
+
+	// Running out of nodes still returns the best placement found so far
+	std::default_random_engine rand(0);
+	Placement start(ckt, 12, 1, 1, 10, rand);
+	bool complete = true;
+	Placement cut = Placement::exact(start, 1, &complete);
+	EXPECT_FALSE(complete);
+	EXPECT_LE(cut.score(), start.score());
+
+	Placement full = Placement::exact(start, -1, &complete);
+	EXPECT_TRUE(complete);
+	EXPECT_LE(full.score(), cut.score());
+}
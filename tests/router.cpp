@@ -0,0 +1,243 @@
+#include <gtest/gtest.h>
+
+#include <sch/Placer.h>
+#include <sch/Router.h>
+
+using namespace sch;
+using namespace std;
+
+// A small technology with one poly and two metal layers, an nmos on ndiff
+// and a pmos on pdiff inside an nwell.
+static Tech buildTech() {
+	Tech tech;
+	const char *names[14] = {
+		"poly", "ndiff", "pdiff", "nwell", "cont", "m1", "via1", "m2",
+		"poly.label", "poly.pin", "m1.label", "m1.pin", "m2.label", "m2.pin"
+	};
+	int widths[14] = {2, 3, 3, 6, 2, 3, 2, 4, 1, 1, 1, 1, 1, 1};
+	for (int i = 0; i < 14; i++) {
+		Paint paint;
+		paint.name = names[i];
+		paint.minWidth = widths[i];
+		paint.fill = false;
+		tech.paint.push_back(paint);
+	}
+
+	Routing wire;
+	wire.isWell = false;
+	for (int i = 0; i < 3; i++) {
+		wire.draw = i == 0 ? 0 : 3+2*i;
+		wire.label = 8+2*i;
+		wire.pin = 9+2*i;
+		tech.wires.push_back(wire);
+	}
+
+	Substrate subst;
+	subst.label = -1;
+	subst.pin = -1;
+	for (int i = 0; i < 3; i++) {
+		subst.draw = 1+i;
+		subst.isWell = i == 2;
+		tech.subst.push_back(subst);
+	}
+
+	Model model;
+	model.type = Model::NMOS;
+	model.name = "nmos";
+	model.stack = {flip(0)};
+	tech.models.push_back(model);
+	model.type = Model::PMOS;
+	model.name = "pmos";
+	model.stack = {flip(1), flip(2)};
+	tech.models.push_back(model);
+
+	Via via;
+	via.label = -1;
+	via.pin = -1;
+	via.isWell = false;
+	via.draw = 4;
+	via.upLevel = 1;
+	via.downLevel = flip(0);
+	tech.vias.push_back(via);
+	via.downLevel = flip(1);
+	tech.vias.push_back(via);
+	via.downLevel = 0;
+	tech.vias.push_back(via);
+	via.draw = 6;
+	via.downLevel = 1;
+	via.upLevel = 2;
+	tech.vias.push_back(via);
+
+	tech.boundary = -1;
+	tech.dbunit = 1;
+	return tech;
+}
+
+// y = !(a&b | c)
+static Subckt buildAoi21(const Tech &tech) {
+	Subckt ckt(true);
+	ckt.name = "aoi21";
+	int gnd = ckt.pushNet("GND", true);
+	int vdd = ckt.pushNet("Vdd", true);
+	int a = ckt.pushNet("A", true);
+	int b = ckt.pushNet("B", true);
+	int c = ckt.pushNet("C", true);
+	int y = ckt.pushNet("Y", true);
+	int m = ckt.pushNet("m");
+	int p = ckt.pushNet("p");
+	ckt.pushMos(tech, 0, Model::NMOS, y, a, m, gnd, vec2i(2, 6));
+	ckt.pushMos(tech, 0, Model::NMOS, m, b, gnd, gnd, vec2i(2, 6));
+	ckt.pushMos(tech, 0, Model::NMOS, y, c, gnd, gnd, vec2i(2, 6));
+	ckt.pushMos(tech, 1, Model::PMOS, p, a, vdd, vdd, vec2i(2, 9));
+	ckt.pushMos(tech, 1, Model::PMOS, p, b, vdd, vdd, vec2i(2, 9));
+	ckt.pushMos(tech, 1, Model::PMOS, y, c, p, vdd, vec2i(2, 9));
+	return ckt;
+}
+
+// Give each contact offsets that depend only on the pin it connects to, so
+// they can be checked after the contacts have moved between routes.
+static int tag(Index idx) {
+	return 100*idx.type + idx.pin + 1;
+}
+
+static void tagContacts(Router &rt) {
+	for (auto r = rt.routes.begin(); r != rt.routes.end(); r++) {
+		for (auto c = r->pins.begin(); c != r->pins.end(); c++) {
+			c->offsetToPin(Index(0, 0), tag(c->idx));
+			c->offsetToPin(Index(1, 0), tag(c->idx)+1000);
+			c->offsetFromPin(Index(0, 1), tag(c->idx)+2000);
+		}
+	}
+}
+
+static void expectTagged(const Router &rt) {
+	for (auto r = rt.routes.begin(); r != rt.routes.end(); r++) {
+		for (auto c = r->pins.begin(); c != r->pins.end(); c++) {
+			// Virtual pins are made after the contacts were tagged
+			if (c->idx.type >= 2) {
+				EXPECT_TRUE(c->toPin.empty());
+				EXPECT_TRUE(c->fromPin.empty());
+				continue;
+			}
+
+			ASSERT_EQ(c->toPin.size(), 2);
+			ASSERT_EQ(c->fromPin.size(), 1);
+			auto to0 = c->toPin.find(Index(0, 0));
+			auto to1 = c->toPin.find(Index(1, 0));
+			auto from = c->fromPin.find(Index(0, 1));
+			ASSERT_TRUE(to0 != c->toPin.end());
+			ASSERT_TRUE(to1 != c->toPin.end());
+			ASSERT_TRUE(from != c->fromPin.end());
+			EXPECT_EQ(to0->second, tag(c->idx));
+			EXPECT_EQ(to1->second, tag(c->idx)+1000);
+			EXPECT_EQ(from->second, tag(c->idx)+2000);
+		}
+	}
+}
+
+static int findRoute(const Router &rt, int net) {
+	for (int i = 0; i < (int)rt.routes.size(); i++) {
+		if (rt.routes[i].net == net) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static int findContact(const Router &rt, int route, int type) {
+	for (auto c = rt.routes[route].pins.begin(); c != rt.routes[route].pins.end(); c++) {
+		if (c->idx.type == type) {
+			return c->idx.pin;
+		}
+	}
+	return -1;
+}
+
+TEST(router, move_pin)
+{
+	Tech tech = buildTech();
+
+	// Moving a pin hands over its offsets instead of copying them
+	Pin pin(tech, 0, 0);
+	pin.offsetToPin(Index(0, 1), 3);
+	const pair<Index, int> *entries = pin.toPin.entries.data();
+	Pin moved(std::move(pin));
+	EXPECT_EQ(moved.toPin.entries.data(), entries);
+	EXPECT_EQ(moved.toPin.size(), 1);
+}
+
+TEST(router, stack_start)
+{
+	Tech tech = buildTech();
+
+	// Two runs of transistors, a-b and c, with a break in the diffusion
+	// between them
+	Stack stack(Model::NMOS);
+	stack.pins.push_back(Pin(tech, 0, -1));
+	stack.pins.push_back(Pin(tech, 0, 1, 0, 2, -1));
+	stack.pins.push_back(Pin(tech, 2, -1));
+	stack.pins.push_back(Pin(tech, 1, 3, 2, 4, -1));
+	stack.pins.push_back(Pin(tech, 4, -1));
+	stack.pins.push_back(Pin(tech, 5, -1));
+	stack.pins.push_back(Pin(tech, 2, 6, 5, 7, -1));
+	stack.pins.push_back(Pin(tech, 7, -1));
+
+	bool start[8] = {true, false, false, false, false, true, false, false};
+	for (int i = 0; i < 8; i++) {
+		EXPECT_EQ(stack.isStart(i), start[i]) << "pin " << i;
+	}
+}
+
+TEST(router, del_route)
+{
+	Tech tech = buildTech();
+	Subckt ckt = buildAoi21(tech);
+	Placement pl = Placement::solve(ckt);
+	Router rt(tech, pl);
+	rt.buildPins();
+	rt.buildRoutes();
+	ASSERT_GE((int)rt.routes.size(), 2);
+	tagContacts(rt);
+
+	// Every route after the deleted one moves down by one
+	int count = (int)rt.routes.size();
+	int net = rt.routes[1].net;
+	rt.delRoute(0);
+	ASSERT_EQ((int)rt.routes.size(), count-1);
+	EXPECT_EQ(rt.routes[0].net, net);
+	expectTagged(rt);
+}
+
+TEST(router, break_route)
+{
+	Tech tech = buildTech();
+	Subckt ckt = buildAoi21(tech);
+	Placement pl = Placement::solve(ckt);
+	Router rt(tech, pl);
+	rt.buildPins();
+	rt.buildRoutes();
+	tagContacts(rt);
+
+	// Y and A both have a pmos and an nmos pin. Constrain each one's pmos pin
+	// above the other's nmos pin to make a cycle that breakRoute() has to
+	// split.
+	int y = findRoute(rt, ckt.findNet("Y"));
+	int a = findRoute(rt, ckt.findNet("A"));
+	ASSERT_GE(y, 0);
+	ASSERT_GE(a, 0);
+	array<int, 2> yPins = {findContact(rt, y, Model::NMOS), findContact(rt, y, Model::PMOS)};
+	array<int, 2> aPins = {findContact(rt, a, Model::NMOS), findContact(rt, a, Model::PMOS)};
+	ASSERT_GE(min(yPins[0], yPins[1]), 0);
+	ASSERT_GE(min(aPins[0], aPins[1]), 0);
+	rt.pinConstraints.clear();
+	rt.pinConstraints.insert(PinConstraint(yPins[Model::PMOS], aPins[Model::NMOS]));
+	rt.pinConstraints.insert(PinConstraint(aPins[Model::PMOS], yPins[Model::NMOS]));
+	rt.indexPinConstraints();
+
+	int count = (int)rt.routes.size();
+	ASSERT_TRUE(rt.breakRoute(y, set<int>({a})));
+	ASSERT_EQ((int)rt.routes.size(), count+1);
+	EXPECT_EQ(rt.routes[y].net, ckt.findNet("Y"));
+	EXPECT_EQ(rt.routes.back().net, ckt.findNet("Y"));
+	expectTagged(rt);
+}
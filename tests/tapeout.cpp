@@ -0,0 +1,276 @@
+#include <gtest/gtest.h>
+
+#include <sch/Tapeout.h>
+#include <sch/Placer.h>
+#include <sch/Router.h>
+#include <sch/Draw.h>
+
+using namespace sch;
+using namespace std;
+
+// A small technology with one poly and two metal layers, an nmos on ndiff
+// and a pmos on pdiff inside an nwell.
+static Tech buildTech() {
+	Tech tech;
+	const char *names[14] = {
+		"poly", "ndiff", "pdiff", "nwell", "cont", "m1", "via1", "m2",
+		"poly.label", "poly.pin", "m1.label", "m1.pin", "m2.label", "m2.pin"
+	};
+	int widths[14] = {2, 3, 3, 6, 2, 3, 2, 4, 1, 1, 1, 1, 1, 1};
+	for (int i = 0; i < 14; i++) {
+		Paint paint;
+		paint.name = names[i];
+		paint.minWidth = widths[i];
+		paint.fill = false;
+		tech.paint.push_back(paint);
+	}
+
+	Routing wire;
+	wire.isWell = false;
+	for (int i = 0; i < 3; i++) {
+		wire.draw = i == 0 ? 0 : 3+2*i;
+		wire.label = 8+2*i;
+		wire.pin = 9+2*i;
+		tech.wires.push_back(wire);
+	}
+
+	Substrate subst;
+	subst.label = -1;
+	subst.pin = -1;
+	for (int i = 0; i < 3; i++) {
+		subst.draw = 1+i;
+		subst.isWell = i == 2;
+		tech.subst.push_back(subst);
+	}
+
+	Model model;
+	model.type = Model::NMOS;
+	model.name = "nmos";
+	model.stack = {flip(0)};
+	tech.models.push_back(model);
+	model.type = Model::PMOS;
+	model.name = "pmos";
+	model.stack = {flip(1), flip(2)};
+	tech.models.push_back(model);
+
+	Via via;
+	via.label = -1;
+	via.pin = -1;
+	via.isWell = false;
+	via.draw = 4;
+	via.upLevel = 1;
+	via.downLevel = flip(0);
+	tech.vias.push_back(via);
+	via.downLevel = flip(1);
+	tech.vias.push_back(via);
+	via.downLevel = 0;
+	tech.vias.push_back(via);
+	via.draw = 6;
+	via.downLevel = 1;
+	via.upLevel = 2;
+	tech.vias.push_back(via);
+
+	tech.boundary = -1;
+	tech.dbunit = 1;
+	return tech;
+}
+
+// y = !(a&b | c)
+static Subckt buildAoi21(const Tech &tech) {
+	Subckt ckt(true);
+	ckt.name = "aoi21";
+	int gnd = ckt.pushNet("GND", true);
+	int vdd = ckt.pushNet("Vdd", true);
+	int a = ckt.pushNet("A", true);
+	int b = ckt.pushNet("B", true);
+	int c = ckt.pushNet("C", true);
+	int y = ckt.pushNet("Y", true);
+	int m = ckt.pushNet("m");
+	int p = ckt.pushNet("p");
+	ckt.pushMos(tech, 0, Model::NMOS, y, a, m, gnd, vec2i(2, 6));
+	ckt.pushMos(tech, 0, Model::NMOS, m, b, gnd, gnd, vec2i(2, 6));
+	ckt.pushMos(tech, 0, Model::NMOS, y, c, gnd, gnd, vec2i(2, 6));
+	ckt.pushMos(tech, 1, Model::PMOS, p, a, vdd, vdd, vec2i(2, 9));
+	ckt.pushMos(tech, 1, Model::PMOS, p, b, vdd, vdd, vec2i(2, 9));
+	ckt.pushMos(tech, 1, Model::PMOS, y, c, p, vdd, vec2i(2, 9));
+	return ckt;
+}
+
+static Layout drawTestCell(const Tech &tech, const Subckt &ckt) {
+	Router rt(tech, Placement::solve(ckt));
+	EXPECT_TRUE(rt.solve());
+	Layout geo(tech);
+	drawCell(geo, rt);
+	return geo;
+}
+
+// y = !(a&b), with the pull down split into two stacks of different widths.
+// Swapping m and n is an automorphism of the graph that fixes every port.
+static Subckt buildSplitNand2(const Tech &tech, int w0, int w1) {
+	Subckt ckt(true);
+	ckt.name = "nand2x";
+	int gnd = ckt.pushNet("GND", true);
+	int vdd = ckt.pushNet("Vdd", true);
+	int a = ckt.pushNet("A", true);
+	int b = ckt.pushNet("B", true);
+	int y = ckt.pushNet("Y", true);
+	int m = ckt.pushNet("m");
+	int n = ckt.pushNet("n");
+	ckt.pushMos(tech, 0, Model::NMOS, y, a, m, gnd, vec2i(2, w0));
+	ckt.pushMos(tech, 0, Model::NMOS, m, b, gnd, gnd, vec2i(2, w0));
+	ckt.pushMos(tech, 0, Model::NMOS, y, a, n, gnd, vec2i(2, w1));
+	ckt.pushMos(tech, 0, Model::NMOS, n, b, gnd, gnd, vec2i(2, w1));
+	ckt.pushMos(tech, 1, Model::PMOS, y, a, vdd, vdd, vec2i(2, 9));
+	ckt.pushMos(tech, 1, Model::PMOS, y, b, vdd, vdd, vec2i(2, 9));
+	return ckt;
+}
+
+// y = !(a&b)
+static Subckt buildNand2(const Tech &tech) {
+	Subckt ckt(true);
+	ckt.name = "nand2";
+	int gnd = ckt.pushNet("GND", true);
+	int vdd = ckt.pushNet("Vdd", true);
+	int a = ckt.pushNet("A", true);
+	int b = ckt.pushNet("B", true);
+	int y = ckt.pushNet("Y", true);
+	int m = ckt.pushNet("m");
+	ckt.pushMos(tech, 0, Model::NMOS, y, a, m, gnd, vec2i(2, 6));
+	ckt.pushMos(tech, 0, Model::NMOS, m, b, gnd, gnd, vec2i(2, 6));
+	ckt.pushMos(tech, 1, Model::PMOS, y, a, vdd, vdd, vec2i(2, 9));
+	ckt.pushMos(tech, 1, Model::PMOS, y, b, vdd, vdd, vec2i(2, 9));
+	return ckt;
+}
+
+static vector<int> routeAll(const Tech &tech, Library &lib, int threads) {
+	Netlist lst(tech);
+	lst.subckts.push_back(buildAoi21(tech));
+	lst.subckts.push_back(buildNand2(tech));
+	lst.subckts.push_back(buildAoi21(tech));
+	lst.subckts.back().name = "aoi21b";
+	return routeLibrary(lib, lst, false, false, nullptr, threads);
+}
+
+TEST(tapeout, extract)
+{
+	Tech tech = buildTech();
+	Subckt ckt = buildAoi21(tech);
+	Layout geo = drawTestCell(tech, ckt);
+
+	Subckt ext = extract(geo);
+	EXPECT_EQ(ext.mos.size(), ckt.mos.size());
+
+	// Every port is recovered from its label, and the base of every pmos
+	// comes from the net that its nwell is annotated with
+	for (auto n = ckt.nets.begin(); n != ckt.nets.end(); n++) {
+		if (n->isIO) {
+			int i = ext.findNet(n->name);
+			ASSERT_GE(i, 0);
+			EXPECT_TRUE(ext.nets[i].isIO);
+		}
+	}
+	int vdd = ext.findNet("Vdd");
+	for (auto m = ext.mos.begin(); m != ext.mos.end(); m++) {
+		EXPECT_GE(m->gate, 0);
+		EXPECT_GE(m->source, 0);
+		EXPECT_GE(m->drain, 0);
+		if (m->type == Model::PMOS) {
+			EXPECT_EQ(m->base, vdd);
+		}
+	}
+
+	EXPECT_TRUE(lvs(geo, ckt));
+}
+
+TEST(tapeout, missing_contact)
+{
+	Tech tech = buildTech();
+	Subckt ckt = buildAoi21(tech);
+	Layout geo = drawTestCell(tech, ckt);
+
+	// Without the contact, whatever it connected to the diffusion is left
+	// floating.
+	auto layer = geo.find(tech.vias[0].draw);
+	ASSERT_TRUE(layer != geo.layers.end());
+	ASSERT_FALSE(layer->geo.empty());
+	layer->geo.erase(layer->geo.begin());
+	EXPECT_FALSE(lvs(geo, ckt));
+}
+
+TEST(tapeout, wrong_width)
+{
+	Tech tech = buildTech();
+	Subckt ckt = buildAoi21(tech);
+
+	// Draw the layout with one transistor wider than in the netlist. The
+	// connections are the same, so only the size check can catch this.
+	Subckt wide = buildAoi21(tech);
+	wide.mos[0].setSize(tech, vec2i(2, 8));
+	Layout geo = drawTestCell(tech, wide);
+	EXPECT_TRUE(lvs(geo, wide));
+	EXPECT_FALSE(lvs(geo, ckt));
+}
+
+TEST(tapeout, symmetric_stacks)
+{
+	Tech tech = buildTech();
+	Subckt ckt = buildSplitNand2(tech, 6, 8);
+	Layout geo = drawTestCell(tech, ckt);
+
+	// The canonical labeling may pair the narrow stack in the netlist with
+	// the wide stack in the layout, which is still a match.
+	EXPECT_TRUE(lvs(geo, ckt));
+
+	Subckt narrow = buildSplitNand2(tech, 6, 6);
+	geo = drawTestCell(tech, narrow);
+	EXPECT_TRUE(lvs(geo, narrow));
+	EXPECT_FALSE(lvs(geo, ckt));
+}
+
+TEST(tapeout, swapped_labels)
+{
+	Tech tech = buildTech();
+	Subckt ckt = buildAoi21(tech);
+	Layout geo = drawTestCell(tech, ckt);
+
+	// A drives the nmos next to Y and B the one next to GND, so swapping
+	// their labels keeps the same ports on a different circuit.
+	for (auto layer = geo.layers.begin(); layer != geo.layers.end(); layer++) {
+		for (auto l = layer->lbl.begin(); l != layer->lbl.end(); l++) {
+			if (l->txt == "A") {
+				l->txt = "B";
+			} else if (l->txt == "B") {
+				l->txt = "A";
+			}
+		}
+	}
+	EXPECT_FALSE(lvs(geo, ckt));
+}
+
+TEST(tapeout, route_library_threads)
+{
+	Tech tech = buildTech();
+
+	// Each cell seeds its own router, so the number of threads doesn't change
+	// the result
+	Library serial(tech);
+	Library parallel(tech);
+	EXPECT_EQ(routeAll(tech, serial, 1), routeAll(tech, parallel, 4));
+	ASSERT_EQ(serial.macros.size(), parallel.macros.size());
+	for (int i = 0; i < (int)serial.macros.size(); i++) {
+		const Layout &l0 = serial.macros[i];
+		const Layout &l1 = parallel.macros[i];
+		ASSERT_EQ(l0.layers.size(), l1.layers.size());
+		for (int j = 0; j < (int)l0.layers.size(); j++) {
+			EXPECT_EQ(l0.layers[j].draw, l1.layers[j].draw);
+			ASSERT_EQ(l0.layers[j].geo.size(), l1.layers[j].geo.size());
+			for (int k = 0; k < (int)l0.layers[j].geo.size(); k++) {
+				const Rect &r0 = l0.layers[j].geo[k];
+				const Rect &r1 = l1.layers[j].geo[k];
+				EXPECT_EQ(r0.net, r1.net);
+				EXPECT_EQ(r0.ll, r1.ll);
+				EXPECT_EQ(r0.ur, r1.ur);
+			}
+		}
+	}
+}